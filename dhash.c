@@ -0,0 +1,680 @@
+#define _GNU_SOURCE
+#include "dhash.h"
+#include "dhash_sketch.h"
+#include "dhash_throttle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#include <openssl/evp.h>
+#include <omp.h>
+
+// Below this many bytes a transform is not worth waking the OpenMP team
+#define PARALLEL_MIN_BYTES (256 * 1024)
+// Transformed bytes buffered before each EVP_DigestUpdate
+#define OUT_BLOCK (1 << 20)
+// Fused tile: input and transformed copy stay in L1 next to the digest state
+#define FUSED_TILE (8 << 10)
+// Ring slots and largest pipe buffer requested when streaming from a pipe
+#define STREAM_SLOTS 4
+#define STREAM_PIPE_MAX (1 << 20)
+
+typedef struct {
+    int r, c;
+    int weight;
+} CoordWeight;
+
+// dhash_table[rot][byte] is the rc5 flattened output of byte for seed rotation rot
+static uint8_t dhash_table[8][256];
+// dhash_rot[byte + prev + next] is generate_shift_seed() folded onto the 8 rotations
+static uint8_t dhash_rot[3 * 255 + 1];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+struct dhash_ctx {
+    EVP_MD_CTX* md_ctx;
+    const EVP_MD* md;
+    dhash_opts opts;
+    uint64_t pos;        // bytes received so far
+    uint8_t last;        // last byte received (prev of the next one)
+    uint8_t pending;     // last byte, held until we know what follows it
+    uint8_t pend_prev;
+    int have_pending;
+    uint8_t frame_next;  // next used by the final byte of the current chunk
+    uint8_t* out;        // staging block, grown on demand up to OUT_BLOCK
+    size_t out_cap;
+    size_t tile_fill;    // fused mode: transformed bytes in out not yet digested
+    dhash_sketch_state* sketch;  // opts.sketch: shingles of the digested bytes
+};
+
+// Converts a byte to a 3x3 grid with 1 blank, as in rc5
+static void to_grid(uint8_t byte, char grid[3][3]) {
+    int k = 0;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            grid[r][c] = (k < 8) ? ((byte >> (7 - k)) & 1) + '0' : '\0';
+            k++;
+        }
+    }
+}
+
+// Same weighted order as rc5 precompute_weighted_patterns(), including its sort
+static void weighted_order(uint8_t byte, int order[8][2]) {
+    static const int position_bias[3][3] = {
+        {3, 2, 3},
+        {2, 4, 2},
+        {3, 2, 3}
+    };
+    char grid[3][3];
+    to_grid(byte, grid);
+
+    CoordWeight coords[9];
+    int count = 0;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            if (grid[r][c] != '\0') {
+                coords[count].r = r;
+                coords[count].c = c;
+                coords[count].weight = (grid[r][c] == '1' ? 10 : 5) + position_bias[r][c];
+                count++;
+            }
+        }
+    }
+
+    for (int i = 0; i < count - 1; i++) {
+        for (int j = i + 1; j < count; j++) {
+            if (coords[j].weight > coords[i].weight) {
+                CoordWeight temp = coords[i];
+                coords[i] = coords[j];
+                coords[j] = temp;
+            }
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        order[i][0] = coords[i].r;
+        order[i][1] = coords[i].c;
+    }
+}
+
+static void build_tables(void) {
+    for (int byte = 0; byte < 256; byte++) {
+        char grid[3][3];
+        int order[8][2];
+        to_grid(byte, grid);
+        weighted_order(byte, order);
+
+        // shuffle_grid_coords() rotates the order by seed; pack the 8 bits MSB first
+        for (int rot = 0; rot < 8; rot++) {
+            uint8_t v = 0;
+            for (int i = 0; i < 8; i++) {
+                int k = (i + rot) % 8;
+                v = (v << 1) | (grid[order[k][0]][order[k][1]] == '1');
+            }
+            dhash_table[rot][byte] = v;
+        }
+    }
+    // Seed 8 rotates by (i + 8) % 8, i.e. the same as seed 0
+    for (int sum = 0; sum <= 3 * 255; sum++) {
+        dhash_rot[sum] = (sum % 9) % 8;
+    }
+}
+
+void dhash_init(void) {
+    pthread_once(&tables_once, build_tables);
+}
+
+static inline uint8_t transform_one(uint8_t byte, uint8_t prev, uint8_t next) {
+    return dhash_table[dhash_rot[byte + prev + next]][byte];
+}
+
+DHASH_CLONES
+void dhash_transform(const uint8_t* in, size_t len, uint8_t prev, uint8_t next, uint8_t* out) {
+    if (len == 0) return;
+    if (len == 1) {
+        out[0] = transform_one(in[0], prev, next);
+        return;
+    }
+    out[0] = transform_one(in[0], prev, in[1]);
+    for (size_t j = 1; j < len - 1; j++) {
+        out[j] = transform_one(in[j], in[j - 1], in[j + 1]);
+    }
+    out[len - 1] = transform_one(in[len - 1], in[len - 2], next);
+}
+
+// rc1-rc3 flatten every byte in the fixed weighted order, whatever its neighbours
+DHASH_CLONES
+static void transform_plain(const uint8_t* in, size_t len, uint8_t* out) {
+    for (size_t j = 0; j < len; j++) out[j] = dhash_table[0][in[j]];
+}
+
+void dhash_transform_frames(const uint8_t* in, size_t len, uint64_t pos, size_t chunk, uint8_t prev, uint8_t* out) {
+    // Each chunk's last byte takes the chunk's first byte as next (0 for chunk 0)
+    for (size_t i = 0; i < len; i += chunk) {
+        size_t n = (len - i < chunk) ? len - i : chunk;
+        uint8_t next = (pos + i == 0) ? 0 : in[i];
+        dhash_transform(in + i, n, i ? in[i - 1] : prev, next, out + i);
+    }
+}
+
+void dhash_transform_run(const dhash_opts* opts, const uint8_t* in, size_t len, uint64_t pos, uint8_t prev,
+                         uint8_t* out) {
+    if (dhash_algo_neighbours(opts->algo)) {
+        dhash_transform_frames(in, len, pos, opts->chunk_size, prev, out);
+    } else {
+        transform_plain(in, len, out);
+    }
+}
+
+int dhash_algo_neighbours(int algo) {
+    return algo >= 4;
+}
+
+int dhash_algo_parse(const char* s, int* algo) {
+    if ((s[0] == 'r' || s[0] == 'R') && (s[1] == 'c' || s[1] == 'C')) s += 2;
+    if (s[0] < '1' || s[0] > '5' || s[1] != '\0') return -1;
+    *algo = s[0] - '0';
+    return 0;
+}
+
+void dhash_format(const dhash_opts* opts, const unsigned char* digest, size_t len, char* out) {
+    if (opts->algo != DHASH_DEFAULT_ALGO) {
+        out += sprintf(out, "rc%d:", opts->algo);
+    }
+    dhash_hex(digest, len, out);
+}
+
+void dhash_opts_init(dhash_opts* opts) {
+    opts->bits = DHASH_DEFAULT_BITS;
+    opts->chunk_size = DHASH_DEFAULT_CHUNK;
+    opts->max_workers = DHASH_DEFAULT_WORKERS;
+    opts->block_size = DHASH_DEFAULT_BLOCK;
+    opts->throttle = NULL;
+    opts->direct_io = 0;
+    opts->huge_pages = 0;
+    opts->numa = 0;
+    opts->decompress = 0;
+    opts->algo = DHASH_DEFAULT_ALGO;
+    opts->fused = 0;
+    opts->sketch = 0;
+}
+
+static const EVP_MD* md_for_bits(int bits) {
+    switch (bits) {
+        case 256:
+            return EVP_sha256();
+        case 512:
+            return EVP_sha512();
+        case 1024:
+        case 2048:
+            return EVP_shake256();
+        default:
+            return NULL;
+    }
+}
+
+int dhash_check_opts(const dhash_opts* opts) {
+    if (!md_for_bits(opts->bits)) {
+        fprintf(stderr, "Unsupported bit size: %d\n", opts->bits);
+        return -1;
+    }
+    if (opts->chunk_size == 0) {
+        fprintf(stderr, "Invalid chunk size: %zu\n", opts->chunk_size);
+        return -1;
+    }
+    if (opts->algo < 1 || opts->algo > 5) {
+        fprintf(stderr, "Unsupported algorithm: rc%d\n", opts->algo);
+        return -1;
+    }
+    if (opts->max_workers < 1) {
+        fprintf(stderr, "Invalid worker count: %d\n", opts->max_workers);
+        return -1;
+    }
+    if (opts->block_size == 0) {
+        fprintf(stderr, "Invalid block size: %zu\n", opts->block_size);
+        return -1;
+    }
+    return 0;
+}
+
+dhash_ctx* dhash_ctx_new(const dhash_opts* opts) {
+    if (dhash_check_opts(opts) != 0) return NULL;
+    dhash_init();
+
+    dhash_ctx* ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        perror("Failed to allocate hash context");
+        return NULL;
+    }
+    ctx->opts = *opts;
+    ctx->md = md_for_bits(opts->bits);
+    ctx->md_ctx = EVP_MD_CTX_new();
+    if (opts->sketch) ctx->sketch = malloc(sizeof(*ctx->sketch));
+    if (!ctx->md_ctx || (opts->sketch && !ctx->sketch)) {
+        perror("Failed to allocate hash context");
+        dhash_ctx_free(ctx);
+        return NULL;
+    }
+    if (dhash_ctx_reset(ctx) != 0) {
+        dhash_ctx_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+int dhash_ctx_reset(dhash_ctx* ctx) {
+    ctx->pos = 0;
+    ctx->last = 0;
+    ctx->pending = 0;
+    ctx->pend_prev = 0;
+    ctx->have_pending = 0;
+    ctx->frame_next = 0;
+    ctx->tile_fill = 0;
+    if (ctx->sketch) dhash_sketch_begin(ctx->sketch);
+    if (EVP_DigestInit_ex(ctx->md_ctx, ctx->md, NULL) != 1) {
+        fprintf(stderr, "Failed to initialise digest\n");
+        return -1;
+    }
+    return 0;
+}
+
+void dhash_ctx_free(dhash_ctx* ctx) {
+    if (!ctx) return;
+    EVP_MD_CTX_free(ctx->md_ctx);
+    free(ctx->out);
+    free(ctx->sketch);
+    free(ctx);
+}
+
+const dhash_opts* dhash_ctx_opts(const dhash_ctx* ctx) {
+    return &ctx->opts;
+}
+
+size_t dhash_ctx_memory(const dhash_opts* opts) {
+    return sizeof(dhash_ctx) + (opts->fused ? FUSED_TILE : OUT_BLOCK)
+         + (opts->sketch ? sizeof(dhash_sketch_state) : 0);
+}
+
+int dhash_ctx_sketch(const dhash_ctx* ctx, dhash_sketch* out) {
+    if (!ctx->sketch) {
+        fprintf(stderr, "Context has no sketch\n");
+        return -1;
+    }
+    dhash_sketch_end(ctx->sketch, out);
+    return 0;
+}
+
+// Every transformed byte reaches the digest through here, so the sketch sees
+// the same stream while it is still in cache
+static int digest_update(dhash_ctx* ctx, const uint8_t* transformed, size_t len) {
+    if (ctx->sketch) dhash_sketch_update(ctx->sketch, transformed, len);
+    if (EVP_DigestUpdate(ctx->md_ctx, transformed, len) != 1) {
+        fprintf(stderr, "Digest update failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int dhash_update_transformed(dhash_ctx* ctx, const uint8_t* transformed, size_t len) {
+    if (digest_update(ctx, transformed, len) != 0) return -1;
+    ctx->pos += len;
+    return 0;
+}
+
+// Contexts for small messages never allocate a whole OUT_BLOCK
+static int reserve_out(dhash_ctx* ctx, size_t n) {
+    if (n <= ctx->out_cap) return 0;
+    size_t cap = ctx->out_cap ? ctx->out_cap : 4096;
+    while (cap < n) cap <<= 1;
+    if (cap > OUT_BLOCK) cap = OUT_BLOCK;
+    uint8_t* p = realloc(ctx->out, cap);
+    if (!p) {
+        perror("Failed to allocate hash context");
+        return -1;
+    }
+    ctx->out = p;
+    ctx->out_cap = cap;
+    return 0;
+}
+
+static int flush_tile(dhash_ctx* ctx) {
+    if (ctx->tile_fill == 0) return 0;
+    if (digest_update(ctx, ctx->out, ctx->tile_fill) != 0) return -1;
+    ctx->tile_fill = 0;
+    return 0;
+}
+
+// Transform bytes [a, b) of a span of the stream that starts at position pos.
+// prev is the byte before the span, frame_next the first byte of the rc5 chunk
+// holding pos (0 for the first chunk) and next the byte after the span; the
+// last byte of every chunk takes its chunk's first byte as next. Slices of one
+// span can be transformed independently. rc1-rc3 use none of the neighbours.
+static void transform_span(const dhash_ctx* ctx, const uint8_t* in, size_t len, uint64_t pos, uint8_t prev,
+                           uint8_t frame_next, uint8_t next, size_t a, size_t b, uint8_t* out) {
+    if (!dhash_algo_neighbours(ctx->opts.algo)) {
+        transform_plain(in + a, b - a, out);
+        return;
+    }
+    const uint64_t chunk = ctx->opts.chunk_size;
+    for (size_t i = a; i < b;) {
+        uint64_t in_frame = (pos + i) % chunk;
+        uint64_t start = pos + i - in_frame;
+        uint8_t first = (start < pos) ? frame_next : (start == 0) ? 0 : in[start - pos];
+        size_t n = (chunk - in_frame < b - i) ? (size_t)(chunk - in_frame) : b - i;
+        uint8_t after = (in_frame + n == chunk) ? first : (i + n < len) ? in[i + n] : next;
+        dhash_transform(in + i, n, i ? in[i - 1] : prev, after, out + (i - a));
+        i += n;
+    }
+}
+
+// Runs are transformed into one L1-sized tile that is digested as soon as it is
+// full, while it and the input it came from are still in cache
+static int emit_fused(dhash_ctx* ctx, const uint8_t* in, size_t len, uint64_t pos, uint8_t prev,
+                      uint8_t frame_next, uint8_t next) {
+    if (reserve_out(ctx, FUSED_TILE) != 0) return -1;
+    dhash_throttle_transform(ctx->opts.throttle, len);
+    for (size_t i = 0; i < len;) {
+        size_t n = FUSED_TILE - ctx->tile_fill;
+        if (n > len - i) n = len - i;
+        transform_span(ctx, in, len, pos, prev, frame_next, next, i, i + n, ctx->out + ctx->tile_fill);
+        ctx->tile_fill += n;
+        i += n;
+        if (ctx->tile_fill == FUSED_TILE && flush_tile(ctx) != 0) return -1;
+    }
+    return 0;
+}
+
+// Transform a span whose neighbours are fully known (see transform_span) and
+// feed it to the digest, OUT_BLOCK bytes at a time split across max_workers
+static int emit(dhash_ctx* ctx, const uint8_t* in, size_t len, uint64_t pos, uint8_t prev, uint8_t frame_next,
+                uint8_t next) {
+    if (ctx->opts.fused) return emit_fused(ctx, in, len, pos, prev, frame_next, next);
+    for (size_t off = 0; off < len;) {
+        size_t n = (len - off < OUT_BLOCK) ? len - off : OUT_BLOCK;
+        if (reserve_out(ctx, n) != 0) return -1;
+        dhash_throttle_transform(ctx->opts.throttle, n);
+
+        if (n >= PARALLEL_MIN_BYTES && ctx->opts.max_workers > 1) {
+            int workers = ctx->opts.max_workers;
+            size_t slice = (n + workers - 1) / workers;
+#pragma omp parallel for num_threads(workers)
+            for (int w = 0; w < workers; w++) {
+                size_t a = (size_t)w * slice;
+                if (a < n) {
+                    size_t b = (a + slice < n) ? a + slice : n;
+                    transform_span(ctx, in, len, pos, prev, frame_next, next, off + a, off + b, ctx->out + a);
+                }
+            }
+        } else {
+            transform_span(ctx, in, len, pos, prev, frame_next, next, off, off + n, ctx->out);
+        }
+
+        if (digest_update(ctx, ctx->out, n) != 0) return -1;
+        off += n;
+    }
+    return 0;
+}
+
+// rc5 reads the file chunk_size bytes at a time and gives the last byte of every
+// chunk after the first the chunk's own first byte as "next" (its peek lags one
+// chunk behind), and 0 for the first chunk and for the end of the file. Only
+// the last byte of each buffer is held back, until its neighbour arrives.
+int dhash_update(dhash_ctx* ctx, const void* data, size_t len) {
+    const uint8_t* in = data;
+    const uint64_t chunk = ctx->opts.chunk_size;
+    if (len == 0) return 0;
+    if (!dhash_algo_neighbours(ctx->opts.algo)) {
+        // No lookahead, so nothing is held back and chunk_size plays no part
+        if (emit(ctx, in, len, ctx->pos, 0, 0, 0) != 0) return -1;
+        ctx->pos += len;
+        return 0;
+    }
+
+    if (ctx->have_pending) {
+        if (emit(ctx, &ctx->pending, 1, ctx->pos - 1, ctx->pend_prev, ctx->frame_next, in[0]) != 0) return -1;
+        ctx->have_pending = 0;
+    }
+    if (len > 1 && emit(ctx, in, len - 1, ctx->pos, ctx->last, ctx->frame_next, in[len - 1]) != 0) return -1;
+
+    // First byte of the chunk holding the new pending byte
+    uint64_t p = ctx->pos + len - 1;
+    uint64_t start = p - p % chunk;
+    if (start >= ctx->pos) {
+        ctx->frame_next = (start == 0) ? 0 : in[start - ctx->pos];
+    }
+    ctx->pending = in[len - 1];
+    ctx->pend_prev = (len > 1) ? in[len - 2] : ctx->last;
+    ctx->have_pending = 1;
+    ctx->last = in[len - 1];
+    ctx->pos += len;
+    return 0;
+}
+
+int dhash_final(dhash_ctx* ctx, unsigned char* out, size_t* out_len) {
+    if (ctx->have_pending) {
+        if (emit(ctx, &ctx->pending, 1, ctx->pos - 1, ctx->pend_prev, ctx->frame_next, ctx->frame_next) != 0) return -1;
+        ctx->have_pending = 0;
+    }
+    if (flush_tile(ctx) != 0) return -1;
+
+    int bits = ctx->opts.bits;
+    if (bits == 1024 || bits == 2048) {
+        if (EVP_DigestFinalXOF(ctx->md_ctx, out, bits / 8) != 1) {
+            fprintf(stderr, "Digest finalisation failed\n");
+            return -1;
+        }
+        *out_len = bits / 8;
+    } else {
+        unsigned int hash_len = 0;
+        if (EVP_DigestFinal_ex(ctx->md_ctx, out, &hash_len) != 1) {
+            fprintf(stderr, "Digest finalisation failed\n");
+            return -1;
+        }
+        *out_len = hash_len;
+    }
+    return 0;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Evict the pages of [off, off + len) that were not resident before we read them,
+// leaving pages other processes had already cached alone
+static void drop_cold_pages(int fd, off_t off, size_t len, const unsigned char* vec, ssize_t pages) {
+    long page = sysconf(_SC_PAGESIZE);
+    off_t first = off - off % page;
+    for (ssize_t i = 0; i < pages;) {
+        if (vec[i] & 1) {
+            i++;
+            continue;
+        }
+        ssize_t j = i;
+        while (j < pages && !(vec[j] & 1)) j++;
+        off_t a = first + (off_t)i * page;
+        off_t b = first + (off_t)j * page;
+        if (a < off) a = off;
+        if (b > off + (off_t)len) b = off + (off_t)len;
+        if (b > a) posix_fadvise(fd, a, b - a, POSIX_FADV_DONTNEED);
+        i = j;
+    }
+}
+
+int dhash_update_fd(dhash_ctx* ctx, int fd, uint8_t* buffer, size_t buffer_size, dhash_io_stats* stats) {
+    dhash_throttle* throttle = ctx->opts.throttle;
+    off_t offset = dhash_throttle_drops_cache(throttle) ? lseek(fd, 0, SEEK_CUR) : -1;
+    // With O_DIRECT a short read is the end of the file, and reading again from the
+    // unaligned offset would fail with EINVAL
+    int fl = fcntl(fd, F_GETFL);
+    int direct = fl >= 0 && (fl & O_DIRECT);
+
+    for (;;) {
+        unsigned char* resident = NULL;
+        ssize_t pages = (offset >= 0) ? dhash_page_residency(fd, offset, buffer_size, &resident) : -1;
+
+        double t0 = stats ? monotonic_seconds() : 0;
+        ssize_t n = read(fd, buffer, buffer_size);
+        if (stats) {
+            stats->read_seconds += monotonic_seconds() - t0;
+            if (n > 0) stats->bytes += (uint64_t)n;
+        }
+        if (n < 0) {
+            free(resident);
+            if (errno == EINTR) continue;
+            perror("Failed to read file");
+            return -1;
+        }
+        if (n == 0) {
+            free(resident);
+            return 0;
+        }
+        dhash_throttle_read(throttle, (size_t)n);
+        int rc = dhash_update(ctx, buffer, (size_t)n);
+        if (pages > 0) drop_cold_pages(fd, offset, (size_t)n, resident, pages);
+        if (offset >= 0) offset += n;
+        free(resident);
+        if (rc != 0) return -1;
+        if (direct && (size_t)n < buffer_size) return 0;
+    }
+}
+
+int dhash_update_stream(dhash_ctx* ctx, int fd, dhash_io_stats* stats) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        // A bigger pipe lets the producer run further ahead of us; unprivileged
+        // users are capped by /proc/sys/fs/pipe-max-size, so failures are fine
+        size_t block = dhash_io_block_size(&ctx->opts);
+        fcntl(fd, F_SETPIPE_SZ, (int)(block < STREAM_PIPE_MAX ? block : STREAM_PIPE_MAX));
+    }
+    dhash_reader* reader = dhash_reader_start(fd, &ctx->opts, STREAM_SLOTS);
+    if (!reader) return -1;
+
+    int rc = 0;
+    for (;;) {
+        const uint8_t* data;
+        double t0 = stats ? monotonic_seconds() : 0;
+        ssize_t n = dhash_reader_next(reader, &data);
+        if (stats) stats->read_seconds += monotonic_seconds() - t0;
+        if (n < 0) rc = -1;
+        if (n <= 0) break;
+        if (stats) stats->bytes += (uint64_t)n;
+        if (dhash_update(ctx, data, (size_t)n) != 0) {
+            rc = -1;
+            break;
+        }
+    }
+    dhash_reader_stop(reader);
+    return rc;
+}
+
+static int hash_file(const char* filename, const dhash_opts* opts, unsigned char* out, size_t* out_len,
+                     dhash_sketch* sketch) {
+    dhash_ctx* ctx = dhash_ctx_new(opts);
+    if (!ctx) return -1;
+
+    int is_stdin = strcmp(filename, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : dhash_open_input(filename, opts);
+    if (fd < 0) {
+        perror("Failed to open file");
+        dhash_ctx_free(ctx);
+        return -1;
+    }
+
+    // Pipes, sockets and terminals deliver short reads at the producer's pace
+    // and cannot be read ahead of with lseek; the reader ring keeps them busy
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode) || S_ISCHR(st.st_mode))) {
+        int rc = dhash_update_stream(ctx, fd, NULL);
+        if (rc == 0) rc = dhash_final(ctx, out, out_len);
+        if (rc == 0 && sketch) rc = dhash_ctx_sketch(ctx, sketch);
+        if (!is_stdin) close(fd);
+        dhash_ctx_free(ctx);
+        return rc;
+    }
+
+    // Heap (or huge page) buffer: chunk and block sizes of any size stay off the stack
+    dhash_buffer buffer;
+    if (dhash_buffer_alloc(&buffer, dhash_io_block_size(opts), opts->huge_pages) != 0) {
+        if (!is_stdin) close(fd);
+        dhash_ctx_free(ctx);
+        return -1;
+    }
+
+    int rc = dhash_update_fd(ctx, fd, buffer.data, buffer.size, NULL);
+    if (rc == 0) rc = dhash_final(ctx, out, out_len);
+    if (rc == 0 && sketch) rc = dhash_ctx_sketch(ctx, sketch);
+
+    dhash_buffer_free(&buffer);
+    if (!is_stdin) close(fd);
+    dhash_ctx_free(ctx);
+    return rc;
+}
+
+int dhash_file(const char* filename, const dhash_opts* opts, unsigned char* out, size_t* out_len) {
+    return hash_file(filename, opts, out, out_len, NULL);
+}
+
+int dhash_file_sketch(const char* filename, const dhash_opts* opts, unsigned char* out, size_t* out_len,
+                      dhash_sketch* sketch) {
+    dhash_opts o = *opts;
+    o.sketch = 1;
+    return hash_file(filename, &o, out, out_len, sketch);
+}
+
+static int hash_iov_ctx(dhash_ctx* ctx, const struct iovec* iov, int iovcnt, unsigned char* out, size_t* out_len) {
+    if (dhash_ctx_reset(ctx) != 0) return -1;
+    // The last byte of each fragment stays pending until the next fragment
+    // supplies its neighbour, so fragments are never joined into one buffer
+    for (int i = 0; i < iovcnt; i++) {
+        if (dhash_update(ctx, iov[i].iov_base, iov[i].iov_len) != 0) return -1;
+    }
+    return dhash_final(ctx, out, out_len);
+}
+
+int dhash_hash_iov(const dhash_opts* opts, const struct iovec* iov, int iovcnt, unsigned char* out, size_t* out_len) {
+    dhash_ctx* ctx = dhash_ctx_new(opts);
+    if (!ctx) return -1;
+    int rc = hash_iov_ctx(ctx, iov, iovcnt, out, out_len);
+    dhash_ctx_free(ctx);
+    return rc;
+}
+
+int dhash_hash_many(const dhash_opts* opts, dhash_object* objects, size_t nobjects) {
+    if (dhash_check_opts(opts) != 0) return -1;
+    // The parallelism is across objects, each hashed on one thread with a
+    // context that is reset rather than rebuilt between objects
+    dhash_opts one = *opts;
+    one.max_workers = 1;
+    int workers = opts->max_workers;
+    if ((size_t)workers > nobjects) workers = nobjects ? (int)nobjects : 1;
+    int failed = 0;
+
+#pragma omp parallel num_threads(workers) reduction(|:failed)
+    {
+        dhash_ctx* ctx = dhash_ctx_new(&one);
+#pragma omp for schedule(dynamic, 16)
+        for (size_t i = 0; i < nobjects; i++) {
+            dhash_object* o = &objects[i];
+            o->rc = ctx ? hash_iov_ctx(ctx, o->iov, o->iovcnt, o->digest, &o->digest_len) : -1;
+            failed |= (o->rc != 0);
+        }
+        dhash_ctx_free(ctx);
+    }
+    return failed ? -1 : 0;
+}
+
+void dhash_hex(const unsigned char* digest, size_t len, char* out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        out[2 * i] = digits[digest[i] >> 4];
+        out[2 * i + 1] = digits[digest[i] & 0xf];
+    }
+    out[2 * len] = '\0';
+}
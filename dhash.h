@@ -0,0 +1,173 @@
+#ifndef DHASH_H
+#define DHASH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DHASH_DEFAULT_BITS 256
+#define DHASH_DEFAULT_CHUNK 512        // rc5 framing unit, see dhash_opts.chunk_size
+#define DHASH_DEFAULT_WORKERS 4
+#define DHASH_DEFAULT_ALGO 5           // rc version whose transform is used, see dhash_opts.algo
+#define DHASH_DEFAULT_BLOCK (1 << 20)  // I/O read size
+#define DHASH_MAX_DIGEST 256           // 2048-bit SHAKE256 output
+#define DHASH_IO_ALIGN 4096            // buffer and O_DIRECT alignment
+#define DHASH_FORMAT_MAX (2 * DHASH_MAX_DIGEST + 8)  // dhash_format output, with the terminator
+
+// Per-byte kernels built once per x86-64 level and picked by the loader when
+// compiled with DHASH_TARGET_CLONES (CMake option of the same name)
+#if defined(DHASH_TARGET_CLONES) && defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define DHASH_CLONES __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "arch=x86-64-v2", "default")))
+#else
+#define DHASH_CLONES
+#endif
+
+typedef struct dhash_throttle dhash_throttle;
+
+typedef struct {
+    int bits;           // 256, 512 (SHA-2) or 1024, 2048 (SHAKE256)
+    size_t chunk_size;  // rc5 chunk framing; part of the digest definition
+    int max_workers;    // OpenMP threads used for large transforms
+    size_t block_size;  // bytes per read(); does not affect the digest
+    dhash_throttle* throttle;  // optional rate limits (dhash_throttle.h), NULL = none
+    int direct_io;      // read with O_DIRECT, bypassing the page cache
+    int huge_pages;     // back read buffers with huge pages when large enough
+    int numa;           // pin workers per NUMA node with node-local buffers (dhash_numa.h)
+    int decompress;     // hash the content of gzip/zstd input (dhash_decompress.c)
+    int algo;           // 1-5: rc1-rc3 (fixed weighted order, no neighbours) or
+                        // rc4/rc5 (neighbour-seeded rotation, chunk framing)
+    int fused;          // transform and digest 8 KiB tiles on one thread; otherwise
+                        // each 1 MiB block is transformed first, split across
+                        // max_workers when at least 256 KiB of it is contiguous
+    int sketch;         // also build a similarity sketch of the transformed stream
+                        // (dhash_sketch.h); does not affect the digest
+} dhash_opts;
+
+// Read buffer that may be a huge-page mapping rather than heap memory
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t mapped;  // mapping length when mmap-backed, 0 for the heap
+} dhash_buffer;
+
+typedef struct dhash_ctx dhash_ctx;
+
+// Optional accounting for the read loops
+typedef struct {
+    uint64_t bytes;       // bytes read
+    double read_seconds;  // time blocked in read()
+} dhash_io_stats;
+
+// Fill opts with the rc5 command line defaults
+void dhash_opts_init(dhash_opts* opts);
+// Validate opts, printing the reason to stderr; returns 0 or -1
+int dhash_check_opts(const dhash_opts* opts);
+
+// Build the byte transform tables (idempotent, thread-safe)
+void dhash_init(void);
+
+// Transform len bytes, using prev/next as the neighbours outside the buffer
+void dhash_transform(const uint8_t* in, size_t len, uint8_t prev, uint8_t next, uint8_t* out);
+
+// Transform a run of whole rc5 chunks starting at stream offset pos (a multiple
+// of chunk); only the last run of a stream may end in a partial chunk. prev is
+// the byte before pos (0 at the start of the stream).
+void dhash_transform_frames(const uint8_t* in, size_t len, uint64_t pos, size_t chunk, uint8_t prev, uint8_t* out);
+
+// dhash_transform_frames for opts->algo: rc1-rc3 ignore pos, prev and chunking
+void dhash_transform_run(const dhash_opts* opts, const uint8_t* in, size_t len, uint64_t pos, uint8_t prev,
+                         uint8_t* out);
+// Whether algo's transform depends on the neighbouring bytes (rc4 and rc5)
+int dhash_algo_neighbours(int algo);
+// "rc3" or "3" to 3; returns -1 for anything but rc1-rc5
+int dhash_algo_parse(const char* s, int* algo);
+
+// Streaming interface; update may be called with arbitrary splits
+dhash_ctx* dhash_ctx_new(const dhash_opts* opts);
+int dhash_ctx_reset(dhash_ctx* ctx);
+int dhash_update(dhash_ctx* ctx, const void* data, size_t len);
+int dhash_final(dhash_ctx* ctx, unsigned char* out, size_t* out_len);
+void dhash_ctx_free(dhash_ctx* ctx);
+const dhash_opts* dhash_ctx_opts(const dhash_ctx* ctx);
+// Bytes a context allocates besides the digest library's own small state
+size_t dhash_ctx_memory(const dhash_opts* opts);
+// Digest bytes already produced by dhash_transform_frames, in stream order. Do
+// not mix with dhash_update on the same context.
+int dhash_update_transformed(dhash_ctx* ctx, const uint8_t* transformed, size_t len);
+
+// Feed everything readable from fd into ctx, using buffer for the reads; stats may be NULL
+int dhash_update_fd(dhash_ctx* ctx, int fd, uint8_t* buffer, size_t buffer_size, dhash_io_stats* stats);
+// Feed a pipe, socket or other unseekable fd into ctx through a read-ahead ring;
+// stats may be NULL and read_seconds counts only time spent waiting for data
+int dhash_update_stream(dhash_ctx* ctx, int fd, dhash_io_stats* stats);
+// Hash a whole file ("-" is standard input); returns 0 on success, -1 (with a
+// message on stderr) on error
+int dhash_file(const char* filename, const dhash_opts* opts, unsigned char* out, size_t* out_len);
+
+// Hash one object held as iovcnt fragments, as if they were concatenated; the
+// fragments are read in place
+int dhash_hash_iov(const dhash_opts* opts, const struct iovec* iov, int iovcnt, unsigned char* out, size_t* out_len);
+
+// One independent object for dhash_hash_many
+typedef struct {
+    const struct iovec* iov;
+    int iovcnt;
+    unsigned char digest[DHASH_MAX_DIGEST];  // results
+    size_t digest_len;
+    int rc;                                  // 0, or -1 if this object failed
+} dhash_object;
+
+// Hash every object, spread over max_workers threads with one reused context
+// each; returns 0 when all objects succeeded, -1 otherwise
+int dhash_hash_many(const dhash_opts* opts, dhash_object* objects, size_t nobjects);
+
+// Content-defined chunking (gear rolling hash with FastCDC normalisation)
+typedef struct {
+    size_t min_size, avg_size, max_size;
+    uint64_t mask_s, mask_l;
+} dhash_cdc_params;
+
+int dhash_cdc_init(dhash_cdc_params* cp, size_t min_size, size_t avg_size, size_t max_size);
+// Length of the first chunk of data; len must reach max_size unless data ends the stream
+size_t dhash_cdc_cut(const dhash_cdc_params* cp, const uint8_t* data, size_t len);
+
+// Buffers and descriptors for the read loops (dhash_io.c)
+size_t dhash_io_block_size(const dhash_opts* opts);
+int dhash_buffer_alloc(dhash_buffer* buf, size_t size, int huge_pages);
+void dhash_buffer_free(dhash_buffer* buf);
+// open() honouring opts->direct_io, falling back to cached reads where O_DIRECT is refused
+int dhash_open_input(const char* path, const dhash_opts* opts);
+
+// Read-ahead thread filling a ring of block_size buffers, so parsing and
+// hashing overlap the reads. Works on pipes and sockets as well as files.
+typedef struct dhash_reader dhash_reader;
+dhash_reader* dhash_reader_start(int fd, const dhash_opts* opts, int slots);
+// Same, with the ring filled by fill(arg, buf, size) on the reader thread
+// instead of read(); fill returns bytes produced, 0 at the end, -1 on error
+typedef ssize_t (*dhash_fill_fn)(void* arg, uint8_t* buf, size_t size);
+dhash_reader* dhash_reader_start_fn(dhash_fill_fn fill, void* arg, int fd, const dhash_opts* opts, int slots);
+// Next block in stream order, valid until the following call; returns its
+// length, 0 at end of stream or -1 on a read error (reported on stderr)
+ssize_t dhash_reader_next(dhash_reader* r, const uint8_t** data);
+// Stop the thread, possibly mid-stream (after any read in progress returns),
+// and free the buffers; fd stays open
+void dhash_reader_stop(dhash_reader* r);
+
+// Write a digest as lowercase hex (out must hold 2 * len + 1 chars)
+void dhash_hex(const unsigned char* digest, size_t len, char* out);
+// Digest as the tools print it: hex, prefixed with "rcN:" unless algo is the
+// default rc5, so legacy digests record how they were made (out must hold
+// DHASH_FORMAT_MAX chars)
+void dhash_format(const dhash_opts* opts, const unsigned char* digest, size_t len, char* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef DHASH_HPP
+#define DHASH_HPP
+
+// Header-only C++17 directional hash engine. The digest and the transform
+// variant are template parameters, the tables are built at compile time from
+// the rc5 weighted patterns, and the per-byte loop has no runtime dispatch.
+// Digests are identical to dhash.h / directional_hash_rc5.c for the same
+// digest width and chunk size.
+//
+//   auto d = dhash::hash<dhash::sha256>(data, len);          // rc5, chunk 512
+//   dhash::engine<dhash::shake256<2048>, dhash::rc3> e;      // streaming
+//   e.update(a, n); e.update(b, m); auto digest = e.final();
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+namespace dhash {
+
+// ---- digests -------------------------------------------------------------
+
+struct sha256 {
+    static constexpr std::size_t size = 32;
+    static constexpr bool xof = false;
+    static const EVP_MD* md() { return EVP_sha256(); }
+};
+
+struct sha512 {
+    static constexpr std::size_t size = 64;
+    static constexpr bool xof = false;
+    static const EVP_MD* md() { return EVP_sha512(); }
+};
+
+// rc5 uses SHAKE256 for its 1024- and 2048-bit outputs
+template <std::size_t Bits>
+struct shake256 {
+    static_assert(Bits % 8 == 0 && Bits > 0, "SHAKE256 output must be whole bytes");
+    static constexpr std::size_t size = Bits / 8;
+    static constexpr bool xof = true;
+    static const EVP_MD* md() { return EVP_shake256(); }
+};
+
+// ---- transform variants --------------------------------------------------
+
+// rc4/rc5: the weighted order is rotated by (byte + prev + next) % 9
+struct rc5 {
+    static constexpr bool neighbours = true;
+};
+
+// rc1-rc3: the plain weighted order, independent of the neighbours and chunks
+struct rc3 {
+    static constexpr bool neighbours = false;
+};
+
+// The other releases produce the same digests as one of the two above
+using rc1 = rc3;
+using rc2 = rc3;
+using rc4 = rc5;
+
+namespace detail {
+
+using table_type = std::array<std::array<std::uint8_t, 256>, 8>;
+
+// The rc5 grid bit at row r, column c (the ninth cell is blank)
+constexpr int grid_bit(int byte, int r, int c) {
+    return (byte >> (7 - (r * 3 + c))) & 1;
+}
+
+// precompute_weighted_patterns() and shuffle_grid_coords(), packed MSB first
+constexpr table_type make_table() {
+    constexpr int position_bias[3][3] = { {3, 2, 3}, {2, 4, 2}, {3, 2, 3} };
+    table_type table{};
+    for (int byte = 0; byte < 256; byte++) {
+        int rs[8] = {}, cs[8] = {}, ws[8] = {};
+        int count = 0;
+        for (int k = 0; k < 8; k++) {
+            int r = k / 3, c = k % 3;
+            rs[count] = r;
+            cs[count] = c;
+            ws[count] = (grid_bit(byte, r, c) ? 10 : 5) + position_bias[r][c];
+            count++;
+        }
+        // rc5's selection-style swap sort, which is not stable; keep it exactly
+        for (int i = 0; i < count - 1; i++) {
+            for (int j = i + 1; j < count; j++) {
+                if (ws[j] > ws[i]) {
+                    int r = rs[i], c = cs[i], w = ws[i];
+                    rs[i] = rs[j];
+                    cs[i] = cs[j];
+                    ws[i] = ws[j];
+                    rs[j] = r;
+                    cs[j] = c;
+                    ws[j] = w;
+                }
+            }
+        }
+        for (int rot = 0; rot < 8; rot++) {
+            int v = 0;
+            for (int i = 0; i < 8; i++) {
+                int k = (i + rot) % 8;
+                v = (v << 1) | grid_bit(byte, rs[k], cs[k]);
+            }
+            table[rot][byte] = static_cast<std::uint8_t>(v);
+        }
+    }
+    return table;
+}
+
+// generate_shift_seed() folded onto the 8 rotations (seed 8 equals seed 0)
+constexpr std::array<std::uint8_t, 3 * 255 + 1> make_rot() {
+    std::array<std::uint8_t, 3 * 255 + 1> rot{};
+    for (int sum = 0; sum <= 3 * 255; sum++) rot[sum] = static_cast<std::uint8_t>((sum % 9) % 8);
+    return rot;
+}
+
+inline constexpr table_type table = make_table();
+inline constexpr std::array<std::uint8_t, 3 * 255 + 1> rot = make_rot();
+
+static_assert(table[0][0x00] == 0x00 && table[0][0xff] == 0xff, "weighted order must permute bits");
+
+}  // namespace detail
+
+// One transformed byte
+template <class Variant = rc5>
+constexpr std::uint8_t transform_byte(std::uint8_t byte, std::uint8_t prev, std::uint8_t next) noexcept {
+    if constexpr (Variant::neighbours) {
+        return detail::table[detail::rot[byte + prev + next]][byte];
+    } else {
+        (void)prev;
+        (void)next;
+        return detail::table[0][byte];
+    }
+}
+
+// Transform len bytes, using prev/next as the neighbours outside the buffer
+template <class Variant = rc5>
+inline void transform(const std::uint8_t* in, std::size_t len, std::uint8_t prev, std::uint8_t next,
+                      std::uint8_t* out) noexcept {
+    if constexpr (!Variant::neighbours) {
+        for (std::size_t j = 0; j < len; j++) out[j] = detail::table[0][in[j]];
+    } else {
+        if (len == 0) return;
+        if (len == 1) {
+            out[0] = transform_byte<Variant>(in[0], prev, next);
+            return;
+        }
+        out[0] = transform_byte<Variant>(in[0], prev, in[1]);
+        for (std::size_t j = 1; j < len - 1; j++) {
+            out[j] = transform_byte<Variant>(in[j], in[j - 1], in[j + 1]);
+        }
+        out[len - 1] = transform_byte<Variant>(in[len - 1], in[len - 2], next);
+    }
+}
+
+// Streaming engine; update() accepts arbitrary splits. chunk_size is the rc5
+// framing and is part of the digest (ignored by variants without neighbours).
+template <class Digest, class Variant = rc5>
+class engine {
+public:
+    using digest_type = std::array<std::uint8_t, Digest::size>;
+    static constexpr std::size_t digest_size = Digest::size;
+
+    explicit engine(std::size_t chunk_size = 512) : chunk_(chunk_size) {
+        if (chunk_ == 0) throw std::invalid_argument("dhash: chunk size must be positive");
+        md_ctx_.reset(EVP_MD_CTX_new());
+        if (!md_ctx_) throw std::bad_alloc();
+        reset();
+    }
+    engine(const engine&) = delete;
+    engine& operator=(const engine&) = delete;
+
+    void reset() {
+        pos_ = 0;
+        last_ = pending_ = pend_prev_ = frame_next_ = 0;
+        have_pending_ = false;
+        if (EVP_DigestInit_ex(md_ctx_.get(), Digest::md(), nullptr) != 1) {
+            throw std::runtime_error("dhash: failed to initialise digest");
+        }
+    }
+
+    // Same framing state machine as dhash_update() in dhash.c
+    void update(const void* data, std::size_t len) {
+        const std::uint8_t* in = static_cast<const std::uint8_t*>(data);
+        if (len == 0) return;
+        if constexpr (!Variant::neighbours) {
+            emit(in, len, 0, 0);
+            pos_ += len;
+            return;
+        }
+
+        if (have_pending_) {
+            std::uint64_t q = pos_ - 1;
+            std::uint8_t next = ((q + 1) % chunk_ == 0) ? frame_next_ : in[0];
+            emit(&pending_, 1, pend_prev_, next);
+            have_pending_ = false;
+        }
+
+        std::size_t i = 0;
+        while (i < len - 1) {
+            std::uint64_t p = pos_ + i;
+            std::uint64_t in_frame = p % chunk_;
+            if (in_frame == 0) frame_next_ = (p == 0) ? 0 : in[i];
+            std::uint64_t frame_left = chunk_ - in_frame;
+            std::size_t end = (frame_left < len - 1 - i) ? i + frame_left : len - 1;
+            std::uint8_t prev = i ? in[i - 1] : last_;
+            std::uint8_t next = (end - i == frame_left) ? frame_next_ : in[end];
+            emit(in + i, end - i, prev, next);
+            i = end;
+        }
+
+        std::uint64_t p = pos_ + len - 1;
+        if (p % chunk_ == 0) frame_next_ = (p == 0) ? 0 : in[len - 1];
+        pending_ = in[len - 1];
+        pend_prev_ = (len > 1) ? in[len - 2] : last_;
+        have_pending_ = true;
+        last_ = in[len - 1];
+        pos_ += len;
+    }
+
+    digest_type final() {
+        if (have_pending_) {
+            emit(&pending_, 1, pend_prev_, frame_next_);
+            have_pending_ = false;
+        }
+        digest_type out{};
+        int ok;
+        if constexpr (Digest::xof) {
+            ok = EVP_DigestFinalXOF(md_ctx_.get(), out.data(), out.size());
+        } else {
+            unsigned int n = 0;
+            ok = EVP_DigestFinal_ex(md_ctx_.get(), out.data(), &n);
+        }
+        if (ok != 1) throw std::runtime_error("dhash: digest finalisation failed");
+        return out;
+    }
+
+private:
+    static constexpr std::size_t out_block = 64 * 1024;  // stays in L2 between transform and digest
+
+    void emit(const std::uint8_t* in, std::size_t len, std::uint8_t prev, std::uint8_t next) {
+        while (len > 0) {
+            std::size_t n = len < out_block ? len : out_block;
+            std::uint8_t block_next = (n < len) ? in[n] : next;
+            transform<Variant>(in, n, prev, block_next, out_.data());
+            if (EVP_DigestUpdate(md_ctx_.get(), out_.data(), n) != 1) {
+                throw std::runtime_error("dhash: digest update failed");
+            }
+            prev = in[n - 1];
+            in += n;
+            len -= n;
+        }
+    }
+
+    struct md_ctx_free {
+        void operator()(EVP_MD_CTX* ctx) const noexcept { EVP_MD_CTX_free(ctx); }
+    };
+
+    std::size_t chunk_;
+    std::unique_ptr<EVP_MD_CTX, md_ctx_free> md_ctx_;
+    std::uint64_t pos_ = 0;
+    std::uint8_t last_ = 0;
+    std::uint8_t pending_ = 0;
+    std::uint8_t pend_prev_ = 0;
+    std::uint8_t frame_next_ = 0;
+    bool have_pending_ = false;
+    std::vector<std::uint8_t> out_ = std::vector<std::uint8_t>(out_block);
+};
+
+// One-shot digest of a buffer
+template <class Digest, class Variant = rc5>
+typename engine<Digest, Variant>::digest_type hash(const void* data, std::size_t len, std::size_t chunk_size = 512) {
+    engine<Digest, Variant> e(chunk_size);
+    e.update(data, len);
+    return e.final();
+}
+
+template <std::size_t N>
+std::string hex(const std::array<std::uint8_t, N>& digest) {
+    static const char digits[] = "0123456789abcdef";
+    std::string s(2 * N, '0');
+    for (std::size_t i = 0; i < N; i++) {
+        s[2 * i] = digits[digest[i] >> 4];
+        s[2 * i + 1] = digits[digest[i] & 15];
+    }
+    return s;
+}
+
+}  // namespace dhash
+
+#endif
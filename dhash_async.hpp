@@ -0,0 +1,397 @@
+#ifndef DHASH_ASYNC_HPP
+#define DHASH_ASYNC_HPP
+
+// C++20 coroutine API on top of dhash.hpp for services built around event
+// loops. Reads, transforms and digests run on a bounded dhash::executor, so no
+// thread blocks per request:
+//
+//   dhash::executor ex(8, 256);   // 8 threads, at most 256 hashes in flight
+//   dhash::task<void> upload(dhash::executor& ex, std::string path) {
+//       auto d = co_await dhash::hash_file<dhash::sha256>(ex, path, {});
+//       ...
+//   }
+//   ex.spawn(upload(ex, path), [](std::exception_ptr e) { ... });
+//
+// Coroutines resume on executor threads; post back to your loop from there if
+// its state is not thread-safe. Backpressure: hash_file waits (suspended, not
+// blocking) for one of the executor's job slots before it allocates a buffer
+// or opens the file, and a streaming update must be awaited before the next.
+// Cancellation: a std::stop_token in the options is checked before every
+// block, and a stopped hash throws dhash::cancelled.
+
+#include "dhash.hpp"
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dhash {
+
+struct cancelled : std::runtime_error {
+    cancelled() : std::runtime_error("dhash: operation cancelled") {}
+};
+
+// ---- task ----------------------------------------------------------------
+
+template <class T = void>
+class task;
+
+namespace detail {
+
+// Resumes whoever awaited the task without growing the stack
+struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <class P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        auto c = h.promise().continuation;
+        return c ? c : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+};
+
+struct promise_base {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <class T>
+struct promise : promise_base {
+    std::optional<T> value;
+    task<T> get_return_object() noexcept;
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T take() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+    void take() {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+}  // namespace detail
+
+// Lazy coroutine: starts when awaited (or spawned) and resumes its awaiter
+template <class T>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+
+    task(task&& other) noexcept : h_(std::exchange(other.h_, {})) {}
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (h_) h_.destroy();
+            h_ = std::exchange(other.h_, {});
+        }
+        return *this;
+    }
+    ~task() {
+        if (h_) h_.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        h_.promise().continuation = awaiting;
+        return h_;
+    }
+    T await_resume() { return h_.promise().take(); }
+
+private:
+    friend promise_type;
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+namespace detail {
+
+template <class T>
+task<T> promise<T>::get_return_object() noexcept {
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept {
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+// Eagerly started, self-destroying coroutine used to run a task to completion
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+}  // namespace detail
+
+// ---- executor ------------------------------------------------------------
+
+// Fixed thread pool with a cap on concurrently admitted jobs
+class executor {
+public:
+    explicit executor(unsigned threads = std::thread::hardware_concurrency(), std::size_t max_jobs = 64)
+        : max_jobs_(max_jobs ? max_jobs : 1) {
+        if (threads == 0) threads = 1;
+        for (unsigned i = 0; i < threads; i++) threads_.emplace_back([this] { run(); });
+    }
+
+    // Finishes queued work, then joins
+    ~executor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    executor(const executor&) = delete;
+    executor& operator=(const executor&) = delete;
+
+    // co_await ex.schedule() continues on a pool thread
+    auto schedule() noexcept {
+        struct awaiter {
+            executor* ex;
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { ex->post(h); }
+            void await_resume() noexcept {}
+        };
+        return awaiter{ this };
+    }
+
+    // Job slot held for the lifetime of one hash; released on destruction
+    class slot {
+    public:
+        slot() = default;
+        explicit slot(executor* ex) noexcept : ex_(ex) {}
+        slot(slot&& other) noexcept : ex_(std::exchange(other.ex_, nullptr)) {}
+        slot& operator=(slot&& other) noexcept {
+            if (this != &other) {
+                reset();
+                ex_ = std::exchange(other.ex_, nullptr);
+            }
+            return *this;
+        }
+        ~slot() { reset(); }
+        void reset() {
+            if (ex_) std::exchange(ex_, nullptr)->release();
+        }
+
+    private:
+        executor* ex_ = nullptr;
+    };
+
+    // co_await ex.admit() suspends while max_jobs are in flight
+    auto admit() noexcept {
+        struct awaiter {
+            executor* ex;
+            bool await_ready() noexcept { return false; }
+            bool await_suspend(std::coroutine_handle<> h) {
+                std::lock_guard<std::mutex> lock(ex->mutex_);
+                if (ex->active_ < ex->max_jobs_) {
+                    ex->active_++;
+                    return false;
+                }
+                ex->admit_waiters_.push_back(h);
+                return true;
+            }
+            slot await_resume() noexcept { return slot(ex); }
+        };
+        return awaiter{ this };
+    }
+
+    // Run t to completion; done(error) is called on a pool thread
+    void spawn(task<void> t, std::function<void(std::exception_ptr)> done = {}) {
+        start(std::move(t), std::move(done));
+    }
+
+    // Block the calling (non-pool) thread until t finishes; for tools and tests
+    template <class T>
+    T sync_wait(task<T> t) {
+        std::promise<T> result;
+        auto future = result.get_future();
+        wait_into(std::move(t), result);
+        return future.get();
+    }
+
+    std::size_t in_flight() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return active_;
+    }
+
+private:
+    void post(std::coroutine_handle<> h) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(h);
+        }
+        ready_.notify_one();
+    }
+
+    // The freed slot passes straight to the oldest waiter
+    void release() {
+        std::coroutine_handle<> next;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (admit_waiters_.empty()) {
+                active_--;
+                return;
+            }
+            next = admit_waiters_.front();
+            admit_waiters_.pop_front();
+        }
+        post(next);
+    }
+
+    void run() {
+        for (;;) {
+            std::coroutine_handle<> h;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                if (queue_.empty()) return;
+                h = queue_.front();
+                queue_.pop_front();
+            }
+            h.resume();
+        }
+    }
+
+    detail::detached start(task<void> t, std::function<void(std::exception_ptr)> done) {
+        co_await schedule();
+        std::exception_ptr error;
+        try {
+            co_await std::move(t);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if (done) done(error);
+    }
+
+    template <class T>
+    detail::detached wait_into(task<T> t, std::promise<T>& result) {
+        co_await schedule();
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await std::move(t);
+                result.set_value();
+            } else {
+                result.set_value(co_await std::move(t));
+            }
+        } catch (...) {
+            result.set_exception(std::current_exception());
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::coroutine_handle<>> queue_;
+    std::deque<std::coroutine_handle<>> admit_waiters_;
+    std::vector<std::thread> threads_;
+    std::size_t max_jobs_;
+    std::size_t active_ = 0;
+    bool stopping_ = false;
+};
+
+// ---- hashing -------------------------------------------------------------
+
+struct async_options {
+    std::size_t chunk_size = 512;       // rc5 framing, part of the digest
+    std::size_t block_size = 1 << 20;   // bytes per read; one executor step each
+    std::stop_token stop;
+};
+
+// Hash a file: waits for a job slot, then reads and digests block by block,
+// yielding to the executor between blocks so large files share the pool
+template <class Digest, class Variant = rc5>
+task<typename engine<Digest, Variant>::digest_type> hash_file(executor& ex, std::string path, async_options opts) {
+    auto slot = co_await ex.admit();
+    co_await ex.schedule();
+    if (opts.stop.stop_requested()) throw cancelled();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), path);
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    struct closer {
+        int fd;
+        ~closer() { ::close(fd); }
+    } guard{ fd };
+
+    engine<Digest, Variant> e(opts.chunk_size);
+    std::vector<std::uint8_t> buffer(opts.block_size ? opts.block_size : 1);
+    off_t offset = 0;
+    for (;;) {
+        if (opts.stop.stop_requested()) throw cancelled();
+        ssize_t n = ::pread(fd, buffer.data(), buffer.size(), offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        if (n == 0) break;
+        e.update(buffer.data(), static_cast<std::size_t>(n));
+        offset += n;
+        co_await ex.schedule();
+    }
+    co_return e.final();
+}
+
+// Streaming context whose updates run on the executor. Await each update
+// before issuing the next; data must stay valid until the update completes.
+template <class Digest, class Variant = rc5>
+class async_context {
+public:
+    using digest_type = typename engine<Digest, Variant>::digest_type;
+
+    explicit async_context(executor& ex, std::size_t chunk_size = 512, std::stop_token stop = {})
+        : ex_(ex), engine_(chunk_size), stop_(std::move(stop)) {}
+
+    task<void> update(const void* data, std::size_t len) {
+        co_await ex_.schedule();
+        if (stop_.stop_requested()) throw cancelled();
+        engine_.update(data, len);
+    }
+
+    task<digest_type> final() {
+        co_await ex_.schedule();
+        if (stop_.stop_requested()) throw cancelled();
+        co_return engine_.final();
+    }
+
+private:
+    executor& ex_;
+    engine<Digest, Variant> engine_;
+    std::stop_token stop_;
+};
+
+}  // namespace dhash
+
+#endif
@@ -0,0 +1,155 @@
+// dhash_async.hpp against the C library: hash_file and a split async_context
+// must give dhash_file's digest, the executor must never admit more than
+// max_jobs hashes at once, and a stopped token must end a hash with
+// dhash::cancelled.
+
+#include "dhash.h"
+#include "dhash_async.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        std::fprintf(stderr, "dhash_async_test: %s\n", what);
+        failures++;
+    }
+}
+
+std::string c_digest(const std::string& path, std::size_t chunk) {
+    dhash_opts opts;
+    dhash_opts_init(&opts);
+    opts.chunk_size = chunk;
+    unsigned char digest[DHASH_MAX_DIGEST];
+    char hex[2 * DHASH_MAX_DIGEST + 1];
+    std::size_t len = 0;
+    if (dhash_file(path.c_str(), &opts, digest, &len) != 0) return "dhash_file failed";
+    dhash_hex(digest, len, hex);
+    return hex;
+}
+
+dhash::task<std::string> split_digest(dhash::executor& ex, const std::vector<std::uint8_t>& data,
+                                      std::size_t chunk) {
+    dhash::async_context<dhash::sha256> ctx(ex, chunk);
+    // Uneven pieces, each awaited before the next
+    for (std::size_t pos = 0, n = 1; pos < data.size(); pos += n, n = n * 3 + 7) {
+        if (n > data.size() - pos) n = data.size() - pos;
+        co_await ctx.update(data.data() + pos, n);
+    }
+    co_return dhash::hex(co_await ctx.final());
+}
+
+// Holds a job slot for a while and records how many are held at once
+dhash::task<void> hold_slot(dhash::executor& ex, std::atomic<int>& held, std::atomic<int>& peak) {
+    auto slot = co_await ex.admit();
+    co_await ex.schedule();
+    int now = ++held;
+    for (int seen = peak.load(); now > seen && !peak.compare_exchange_weak(seen, now);) {}
+    usleep(200);
+    held--;
+}
+
+dhash::task<void> hash_into(dhash::executor& ex, std::string path, std::string& out) {
+    out = dhash::hex(co_await dhash::hash_file<dhash::sha256>(ex, path, {}));
+}
+
+}  // namespace
+
+int main() {
+    const char* tmpdir = std::getenv("TMPDIR");
+    if (!tmpdir || !*tmpdir) tmpdir = "/tmp";
+    char path[4096];
+    std::snprintf(path, sizeof(path), "%s/dhash-async-XXXXXX", tmpdir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::perror("mkstemp");
+        return 1;
+    }
+    std::vector<std::uint8_t> data(3 * 1048576 + 12345);
+    std::uint64_t x = 0x6468617368617379ULL;  // "dhashasy"
+    for (auto& b : data) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        b = static_cast<std::uint8_t>(x >> 56);
+    }
+    if (write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+        std::perror(path);
+        return 1;
+    }
+    close(fd);
+    dhash_init();
+
+    const std::size_t max_jobs = 4;
+    {
+        dhash::executor ex(3, max_jobs);
+
+        // hash_file over several block sizes
+        std::string want = c_digest(path, 512);
+        for (std::size_t block : { std::size_t(1) << 20, std::size_t(65537), std::size_t(4096) }) {
+            dhash::async_options o;
+            o.block_size = block;
+            auto got = ex.sync_wait(dhash::hash_file<dhash::sha256>(ex, path, o));
+            check(dhash::hex(got) == want, "hash_file differs from dhash_file");
+        }
+
+        // async_context fed in pieces, at another chunk size
+        check(ex.sync_wait(split_digest(ex, data, 4096)) == c_digest(path, 4096),
+              "split async_context differs from dhash_file");
+
+        // Admission: many slot holders and hashes at once, sampled from outside
+        std::atomic<int> held{ 0 }, peak{ 0 }, done{ 0 };
+        std::size_t most = 0;
+        const int holders = 64, hashes = 8;
+        std::vector<std::string> digests(hashes);
+        for (int i = 0; i < holders; i++) {
+            ex.spawn(hold_slot(ex, held, peak), [&](std::exception_ptr) { done++; });
+        }
+        for (int i = 0; i < hashes; i++) {
+            ex.spawn(hash_into(ex, path, digests[i]), [&](std::exception_ptr) { done++; });
+        }
+        while (done < holders + hashes) {
+            std::size_t n = ex.in_flight();
+            if (n > most) most = n;
+        }
+        check(most <= max_jobs && static_cast<std::size_t>(peak.load()) <= max_jobs,
+              "in_flight() exceeded max_jobs");
+        check(ex.in_flight() == 0, "job slots leaked");
+        for (const auto& d : digests) check(d == want, "concurrent hash_file differs from dhash_file");
+
+        // Cancellation
+        std::stop_source stop;
+        stop.request_stop();
+        dhash::async_options o;
+        o.stop = stop.get_token();
+        bool threw = false;
+        try {
+            ex.sync_wait(dhash::hash_file<dhash::sha256>(ex, path, o));
+        } catch (const dhash::cancelled&) {
+            threw = true;
+        }
+        check(threw, "stopped hash_file did not throw dhash::cancelled");
+        threw = false;
+        try {
+            dhash::async_context<dhash::sha256> ctx(ex, 512, stop.get_token());
+            ex.sync_wait(ctx.update(data.data(), data.size()));
+        } catch (const dhash::cancelled&) {
+            threw = true;
+        }
+        check(threw, "stopped async_context did not throw dhash::cancelled");
+        check(ex.in_flight() == 0, "cancelled hash kept its job slot");
+    }
+    unlink(path);
+
+    if (failures) return 1;
+    std::printf("dhash_async_test: hash_file, async_context, admission and cancellation match\n");
+    return 0;
+}
@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include "dhash_numa.h"
+#include "dhash_modes.h"
+#include "dhash_sketch.h"
+#include "dhash_throttle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <omp.h>
+
+#define BATCH_CACHED 0.5              // resident fraction from which a file counts as cached
+#define BATCH_PROBE_WINDOW (256u << 20) // mincore fallback maps this much at a time
+
+#ifndef __NR_cachestat
+#define __NR_cachestat 451  // Linux 6.5; the same number on every architecture
+#endif
+
+struct batch_cachestat_range {
+    uint64_t off;
+    uint64_t len;  // 0 for the rest of the file
+};
+
+struct batch_cachestat {
+    uint64_t nr_cache;
+    uint64_t nr_dirty;
+    uint64_t nr_writeback;
+    uint64_t nr_evicted;
+    uint64_t nr_recently_evicted;
+};
+
+typedef struct {
+    uint64_t size;
+    int cached;  // most of the file is already in page cache
+    int split;
+} batch_job;
+
+typedef struct {
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t digest_len;
+    dhash_sketch sketch;  // with opts.sketch
+    int ok;
+} batch_result;
+
+typedef struct {
+    char** files;
+    int nfiles;
+    const dhash_opts* opts;
+    dhash_metrics* metrics;
+    batch_result* results;
+    char* done;
+    int next_print;
+    int started, completed;
+    int failed;
+} batch_state;
+
+// Admission control: bytes of buffers and contexts held by running jobs
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+    size_t limit;  // 0 for no limit
+    size_t used;
+} batch_budget;
+
+// Wait until n more bytes fit; a job runs alone even if it is over the limit
+static void budget_take(batch_budget* b, size_t n) {
+    if (!b->limit) return;
+    pthread_mutex_lock(&b->lock);
+    while (b->used > 0 && b->used + n > b->limit) pthread_cond_wait(&b->freed, &b->lock);
+    b->used += n;
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void budget_give(batch_budget* b, size_t n) {
+    if (!b->limit || n == 0) return;
+    pthread_mutex_lock(&b->lock);
+    b->used -= n;
+    pthread_cond_broadcast(&b->freed);
+    pthread_mutex_unlock(&b->lock);
+}
+
+// Fraction of the file's pages in page cache: cachestat() where the kernel has
+// it, else mincore() over a window mapped at a time
+static double resident_fraction(int fd, uint64_t size) {
+    if (size == 0) return 1;
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t pages = (size + page - 1) / page;
+    struct batch_cachestat_range range = { 0, 0 };
+    struct batch_cachestat cs;
+    if (syscall(__NR_cachestat, fd, &range, &cs, 0) == 0) return (double)cs.nr_cache / pages;
+
+    uint64_t resident = 0;
+    for (uint64_t off = 0; off < size; off += BATCH_PROBE_WINDOW) {
+        size_t len = size - off < BATCH_PROBE_WINDOW ? (size_t)(size - off) : BATCH_PROBE_WINDOW;
+        unsigned char* vec = NULL;
+        ssize_t n = dhash_page_residency(fd, (off_t)off, len, &vec);
+        if (n < 0) return 0;
+        for (ssize_t i = 0; i < n; i++) resident += vec[i] & 1;
+        free(vec);
+    }
+    return (double)resident / pages;
+}
+
+static void probe_job(const char* path, batch_job* job) {
+    memset(job, 0, sizeof(*job));
+    // Failures are reported when the file is hashed
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        job->size = (uint64_t)st.st_size;
+        job->cached = resident_fraction(fd, job->size) >= BATCH_CACHED;
+    }
+    close(fd);
+}
+
+static int compare_jobs(const void* pa, const void* pb, void* arg) {
+    const batch_job* jobs = ((void**)arg)[0];
+    dhash_batch_order order = *(const dhash_batch_order*)((void**)arg)[1];
+    int a = *(const int*)pa, b = *(const int*)pb;
+    if (jobs[a].cached != jobs[b].cached) return jobs[b].cached - jobs[a].cached;
+    if (jobs[a].size != jobs[b].size) {
+        int larger = jobs[a].size > jobs[b].size ? -1 : 1;
+        return order == DHASH_ORDER_LARGEST ? larger : -larger;
+    }
+    return a - b;  // stable, so equal files keep their input order
+}
+
+// Read buffer for a file: no bigger than the file, in power-of-two steps so a
+// worker does not reallocate for every small file
+static size_t job_buffer_size(const dhash_opts* opts, uint64_t size) {
+    size_t block = dhash_io_block_size(opts);
+    size_t n = DHASH_IO_ALIGN;
+    while (n < block && n < size) n <<= 1;
+    return n < block ? n : block;
+}
+
+static int hash_one(const char* path, dhash_ctx* ctx, uint8_t* buffer, size_t buffer_size,
+                    batch_result* res, dhash_metrics* metrics) {
+    double t0 = dhash_metrics_now();
+    dhash_io_stats io = { 0 };
+    int rc = -1;
+
+    int fd = dhash_open_input(path, dhash_ctx_opts(ctx));
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    } else {
+        if (dhash_ctx_reset(ctx) == 0 && dhash_update_fd(ctx, fd, buffer, buffer_size, &io) == 0) {
+            rc = dhash_final(ctx, res->digest, &res->digest_len);
+            if (rc == 0 && dhash_ctx_opts(ctx)->sketch) rc = dhash_ctx_sketch(ctx, &res->sketch);
+        }
+        close(fd);
+    }
+    res->ok = (rc == 0);
+    dhash_metrics_record(metrics, io.bytes, dhash_metrics_now() - t0, io.read_seconds, res->ok);
+    return rc;
+}
+
+// All workers on one file through the segmented pipeline of dhash_numa_file
+// (pinned only with --numa), narrowed until its buffers fit the budget
+static void hash_split(batch_state* s, int i, batch_budget* budget, int workers) {
+    const dhash_opts* opts = s->opts;
+    size_t seg = (opts->block_size + opts->chunk_size - 1) / opts->chunk_size * opts->chunk_size;
+    size_t per_worker = 3 * seg;  // input plus two transformed segments
+    size_t fixed = dhash_ctx_memory(opts);
+    while (budget->limit && workers > 1 && fixed + workers * per_worker > budget->limit) workers--;
+
+    dhash_opts split_opts = *opts;
+    split_opts.max_workers = workers;
+    size_t need = fixed + workers * per_worker;
+    budget_take(budget, need);
+    double t0 = dhash_metrics_now();
+    batch_result* res = &s->results[i];
+    res->ok = dhash_numa_file(s->files[i], &split_opts, res->digest, &res->digest_len) == 0;
+    struct stat st;
+    uint64_t bytes = (res->ok && stat(s->files[i], &st) == 0) ? (uint64_t)st.st_size : 0;
+    dhash_metrics_record(s->metrics, bytes, dhash_metrics_now() - t0, 0, res->ok);
+    budget_give(budget, need);
+}
+
+static void job_started(batch_state* s) {
+    int now_started = __atomic_add_fetch(&s->started, 1, __ATOMIC_RELAXED);
+    dhash_metrics_queue(s->metrics, s->nfiles - now_started,
+                        now_started - __atomic_load_n(&s->completed, __ATOMIC_RELAXED));
+}
+
+static void job_finished(batch_state* s, int i) {
+    char hex[DHASH_FORMAT_MAX];
+    char sketch[DHASH_SKETCH_TEXT];
+#pragma omp critical(batch_output)
+    {
+        // Print in input order as soon as the prefix is complete
+        s->done[i] = 1;
+        __atomic_add_fetch(&s->completed, 1, __ATOMIC_RELAXED);
+        while (s->next_print < s->nfiles && s->done[s->next_print]) {
+            batch_result* r = &s->results[s->next_print];
+            if (r->ok) {
+                dhash_format(s->opts, r->digest, r->digest_len, hex);
+                if (s->opts->sketch) {
+                    dhash_sketch_format(&r->sketch, sketch);
+                    printf("%s %s  %s\n", hex, sketch, s->files[s->next_print]);
+                } else {
+                    printf("%s  %s\n", hex, s->files[s->next_print]);
+                }
+            } else {
+                s->failed = 1;
+            }
+            s->next_print++;
+        }
+        dhash_metrics_queue(s->metrics, s->nfiles - __atomic_load_n(&s->started, __ATOMIC_RELAXED),
+                            __atomic_load_n(&s->started, __ATOMIC_RELAXED) - s->completed);
+    }
+}
+
+// Files are dealt round-robin to nodes; a worker drains its own node's share
+// before stealing from the others. Without --numa there is a single queue.
+static int claim_file(int* next, int nnodes, int nfiles, int home) {
+    for (int k = 0; k < nnodes; k++) {
+        int node = (home + k) % nnodes;
+        int j = __atomic_fetch_add(&next[node], 1, __ATOMIC_RELAXED);
+        int i = node + j * nnodes;
+        if (i < nfiles) return i;
+    }
+    return -1;
+}
+
+static void run_pool(batch_state* s, const batch_job* jobs, const int* pool, int npool, batch_budget* budget) {
+    const dhash_opts* opts = s->opts;
+    dhash_opts file_opts = *opts;
+    file_opts.max_workers = 1;  // one file per worker
+    dhash_numa_topology topo;
+    topo.nnodes = 1;
+    if (opts->numa) dhash_numa_detect(&topo);
+    int next[DHASH_MAX_NODES] = { 0 };
+    size_t ctx_memory = dhash_ctx_memory(&file_opts);
+
+#pragma omp parallel num_threads(opts->max_workers)
+    {
+        int home = omp_get_thread_num() % topo.nnodes;
+        // Pin before allocating so the context and buffer are node-local
+        cpu_set_t saved;
+        int pinned = opts->numa && dhash_numa_bind(&topo, home, &saved) == 0;
+        dhash_ctx* ctx = NULL;
+        dhash_buffer buffer = { 0 };
+        size_t held = 0;
+
+        int k;
+        while ((k = claim_file(next, topo.nnodes, npool, home)) >= 0) {
+            int i = pool[k];
+            job_started(s);
+            size_t want = job_buffer_size(opts, jobs[i].size);
+            // Keep a big enough buffer unless it is far bigger than needed;
+            // never wait for the budget while holding any of it
+            if (!ctx || buffer.size < want || buffer.size > 4 * want) {
+                dhash_buffer_free(&buffer);
+                dhash_ctx_free(ctx);
+                budget_give(budget, held);
+                held = ctx_memory + want;
+                budget_take(budget, held);
+                ctx = dhash_ctx_new(&file_opts);
+                dhash_buffer_alloc(&buffer, want, opts->huge_pages);  // data stays NULL on failure
+            } else {
+                dhash_metrics_cache_hit(s->metrics);
+            }
+            if (!ctx || !buffer.data) {
+                s->results[i].ok = 0;
+            } else {
+                hash_one(s->files[i], ctx, buffer.data, buffer.size, &s->results[i], s->metrics);
+            }
+            job_finished(s, i);
+        }
+
+        dhash_buffer_free(&buffer);
+        dhash_ctx_free(ctx);
+        budget_give(budget, held);
+        if (pinned) dhash_numa_restore(&saved);
+    }
+}
+
+int dhash_batch_run(char** files, int nfiles, const dhash_opts* opts, const dhash_batch_opts* sched,
+                    dhash_metrics* metrics) {
+    batch_state s = { .files = files, .nfiles = nfiles, .opts = opts, .metrics = metrics };
+    int slots = nfiles ? nfiles : 1;
+    s.results = calloc(slots, sizeof(*s.results));
+    s.done = calloc(slots, 1);
+    batch_job* jobs = calloc(slots, sizeof(*jobs));
+    int* pool = malloc(slots * sizeof(int));
+    int* split = malloc(slots * sizeof(int));
+    if (!s.results || !s.done || !jobs || !pool || !split) {
+        perror("Failed to allocate batch results");
+        free(s.results);
+        free(s.done);
+        free(jobs);
+        free(pool);
+        free(split);
+        return 1;
+    }
+
+    if (sched->order != DHASH_ORDER_INPUT || sched->split_size) {
+#pragma omp parallel for num_threads(opts->max_workers) schedule(dynamic, 64)
+        for (int i = 0; i < nfiles; i++) probe_job(files[i], &jobs[i]);
+    }
+    int npool = 0, nsplit = 0;
+    for (int i = 0; i < nfiles; i++) {
+        // The segmented pipeline has no sketch to return
+        jobs[i].split = sched->split_size && opts->max_workers > 1 && !opts->sketch
+                     && jobs[i].size >= sched->split_size;
+        if (jobs[i].split) split[nsplit++] = i;
+        else pool[npool++] = i;
+    }
+    if (sched->order != DHASH_ORDER_INPUT) {
+        dhash_batch_order order = sched->order;
+        void* arg[2] = { jobs, &order };
+        qsort_r(pool, npool, sizeof(int), compare_jobs, arg);
+        qsort_r(split, nsplit, sizeof(int), compare_jobs, arg);
+    }
+
+    batch_budget budget = { .limit = sched->mem_budget };
+    pthread_mutex_init(&budget.lock, NULL);
+    pthread_cond_init(&budget.freed, NULL);
+
+    // Split files take every worker, so they run on their own: first when the
+    // largest files go first, last otherwise
+    int split_first = sched->order == DHASH_ORDER_LARGEST;
+    for (int k = 0; split_first && k < nsplit; k++) {
+        job_started(&s);
+        hash_split(&s, split[k], &budget, opts->max_workers);
+        job_finished(&s, split[k]);
+    }
+    run_pool(&s, jobs, pool, npool, &budget);
+    for (int k = 0; !split_first && k < nsplit; k++) {
+        job_started(&s);
+        hash_split(&s, split[k], &budget, opts->max_workers);
+        job_finished(&s, split[k]);
+    }
+
+    pthread_mutex_destroy(&budget.lock);
+    pthread_cond_destroy(&budget.freed);
+    free(jobs);
+    free(pool);
+    free(split);
+    free(s.done);
+    free(s.results);
+    return s.failed;
+}
+
+int dhash_read_file_list(const char* list_path, char*** files, int* nfiles) {
+    FILE* f = strcmp(list_path, "-") == 0 ? stdin : fopen(list_path, "r");
+    if (!f) {
+        perror(list_path);
+        return -1;
+    }
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int count = *nfiles, alloc = count + 64;
+    char** list = realloc(*files, alloc * sizeof(char*));
+    if (!list) return -1;
+
+    while ((len = getline(&line, &cap, f)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+        if (len == 0) continue;
+        if (count == alloc) {
+            alloc *= 2;
+            char** grown = realloc(list, alloc * sizeof(char*));
+            if (!grown) break;
+            list = grown;
+        }
+        list[count++] = strdup(line);
+    }
+    free(line);
+    if (f != stdin) fclose(f);
+    *files = list;
+    *nfiles = count;
+    return 0;
+}
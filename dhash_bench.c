@@ -0,0 +1,229 @@
+// End-to-end benchmark of the in-memory hashing paths on a synthetic corpus:
+// MB/s and bytes per cycle for the blocked transform (one thread and
+// max_workers), the fused L1-tile loop, and the bare digest as the ceiling.
+//
+//   gcc -O2 -fopenmp dhash_bench.c dhash.c dhash_io.c dhash_throttle.c dhash_sketch.c -o dhash_bench -lcrypto
+//   ./dhash_bench [--bits N] [--chunk-size N] [--algo rcN] [--workers N] [--size N]... [--repeats N]
+//
+// Cycles come from the TSC on x86 (wall-clock reference cycles, so multithreaded
+// rows show bytes per elapsed cycle) and from the perf cycle counter of the
+// calling thread elsewhere. Every dhash row must produce the same digest.
+
+#define _GNU_SOURCE
+#include "dhash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <openssl/evp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_MAX_SIZES 8
+#define BENCH_REPEATS 5
+
+// Small, L2-sized and memory-sized inputs
+static const size_t default_sizes[] = { 64 << 10, 1 << 20, 64 << 20 };
+
+typedef enum { PATH_DIGEST, PATH_BLOCKED, PATH_BLOCKED_OMP, PATH_FUSED, PATH_COUNT } bench_path;
+static const char* path_names[PATH_COUNT] = { "digest", "blocked", "blocked-omp", "fused" };
+
+#if !defined(__x86_64__) && !defined(__i386__)
+static int perf_fd = -1;
+#endif
+
+static const char* cycles_open(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return "TSC";
+#else
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    return perf_fd >= 0 ? "perf cycles" : NULL;
+#endif
+}
+
+static uint64_t cycles_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    uint64_t v = 0;
+    if (perf_fd < 0 || read(perf_fd, &v, sizeof(v)) != sizeof(v)) return 0;
+    return v;
+#endif
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Same generator as the --autotune sample, so the corpora match
+static void fill_corpus(uint8_t* data, size_t size) {
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < size; i += 8) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(data + i, &x, size - i < 8 ? size - i : 8);
+    }
+}
+
+// Bytes handed over block_size at a time, as the read loops do
+static int run_dhash(const uint8_t* data, size_t size, const dhash_opts* opts, unsigned char* out, size_t* out_len) {
+    dhash_ctx* ctx = dhash_ctx_new(opts);
+    if (!ctx) return -1;
+    int rc = 0;
+    for (size_t i = 0; i < size && rc == 0; i += opts->block_size) {
+        rc = dhash_update(ctx, data + i, size - i < opts->block_size ? size - i : opts->block_size);
+    }
+    if (rc == 0) rc = dhash_final(ctx, out, out_len);
+    dhash_ctx_free(ctx);
+    return rc;
+}
+
+// The untransformed input straight into the digest: no dhash path can beat it
+static int run_digest(const uint8_t* data, size_t size, int bits) {
+    const EVP_MD* md = bits == 256 ? EVP_sha256() : bits == 512 ? EVP_sha512() : EVP_shake256();
+    unsigned char out[DHASH_MAX_DIGEST];
+    unsigned int len = 0;
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    int ok = ctx && EVP_DigestInit_ex(ctx, md, NULL) == 1 && EVP_DigestUpdate(ctx, data, size) == 1
+          && (bits > 512 ? EVP_DigestFinalXOF(ctx, out, bits / 8) : EVP_DigestFinal_ex(ctx, out, &len)) == 1;
+    EVP_MD_CTX_free(ctx);
+    return ok ? 0 : -1;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [--bits N] [--chunk-size N] [--algo rcN] [--workers N] [--block-size N]\n"
+            "       [--size N]... [--repeats N]\n",
+            prog);
+}
+
+int main(int argc, char* argv[]) {
+    dhash_opts opts;
+    dhash_opts_init(&opts);
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    opts.max_workers = ncpu > 1 ? (int)ncpu : 1;
+    size_t sizes[BENCH_MAX_SIZES];
+    int nsizes = 0;
+    int repeats = BENCH_REPEATS;
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        int bad = !value;
+        if (strcmp(argv[i], "--bits") == 0 && value) {
+            opts.bits = atoi(value);
+        } else if (strcmp(argv[i], "--chunk-size") == 0 && value) {
+            opts.chunk_size = strtoull(value, NULL, 0);
+        } else if (strcmp(argv[i], "--algo") == 0 && value) {
+            bad = dhash_algo_parse(value, &opts.algo) != 0;
+        } else if (strcmp(argv[i], "--workers") == 0 && value) {
+            opts.max_workers = atoi(value);
+        } else if (strcmp(argv[i], "--block-size") == 0 && value) {
+            opts.block_size = strtoull(value, NULL, 0);
+        } else if (strcmp(argv[i], "--size") == 0 && value && nsizes < BENCH_MAX_SIZES) {
+            sizes[nsizes++] = strtoull(value, NULL, 0);
+            bad = sizes[nsizes - 1] == 0;
+        } else if (strcmp(argv[i], "--repeats") == 0 && value) {
+            repeats = atoi(value);
+            bad = repeats < 1;
+        } else {
+            bad = 1;
+        }
+        if (bad) {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (dhash_check_opts(&opts) != 0) return 2;
+    if (nsizes == 0) {
+        nsizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+    }
+    size_t max_size = 0;
+    for (int s = 0; s < nsizes; s++) {
+        if (sizes[s] > max_size) max_size = sizes[s];
+    }
+    uint8_t* data = malloc(max_size);
+    if (!data) {
+        perror("Failed to allocate corpus");
+        return 1;
+    }
+    fill_corpus(data, max_size);
+    dhash_init();
+
+    const char* clock_name = cycles_open();
+    printf("rc%d, %d-bit digest, chunk %zu, block %zu, %d workers, best of %d; cycles: %s\n", opts.algo,
+           opts.bits, opts.chunk_size, opts.block_size, opts.max_workers, repeats,
+           clock_name ? clock_name : "unavailable");
+    printf("%-12s %10s %10s %11s\n", "path", "size", "MB/s", "bytes/cycle");
+
+    int rc = 0;
+    for (int s = 0; s < nsizes && rc == 0; s++) {
+        char want[2 * DHASH_MAX_DIGEST + 1] = "";
+        for (int p = 0; p < PATH_COUNT && rc == 0; p++) {
+            dhash_opts o = opts;
+            o.max_workers = (p == PATH_BLOCKED_OMP) ? opts.max_workers : 1;
+            o.fused = (p == PATH_FUSED);
+            double best_seconds = 0;
+            uint64_t best_cycles = 0;
+            for (int r = 0; r < repeats; r++) {
+                unsigned char digest[DHASH_MAX_DIGEST];
+                size_t len = 0;
+                double t0 = now_seconds();
+                uint64_t c0 = cycles_now();
+                int failed = (p == PATH_DIGEST) ? run_digest(data, sizes[s], opts.bits)
+                                                : run_dhash(data, sizes[s], &o, digest, &len);
+                uint64_t c1 = cycles_now();
+                double dt = now_seconds() - t0;
+                if (failed) {
+                    rc = 1;
+                    break;
+                }
+                if (p != PATH_DIGEST) {
+                    char hex[2 * DHASH_MAX_DIGEST + 1];
+                    dhash_hex(digest, len, hex);
+                    if (!want[0]) {
+                        strcpy(want, hex);
+                    } else if (strcmp(want, hex) != 0) {
+                        fprintf(stderr, "%s digest differs: %s vs %s\n", path_names[p], hex, want);
+                        rc = 1;
+                        break;
+                    }
+                }
+                if (best_seconds == 0 || dt < best_seconds) {
+                    best_seconds = dt;
+                    best_cycles = c1 - c0;
+                }
+            }
+            if (rc != 0) break;
+
+            char size_str[32];
+            if (sizes[s] % 1024 == 0) snprintf(size_str, sizeof(size_str), "%zuK", sizes[s] >> 10);
+            else snprintf(size_str, sizeof(size_str), "%zu", sizes[s]);
+            printf("%-12s %10s %10.1f ", path_names[p], size_str,
+                   best_seconds > 0 ? sizes[s] / best_seconds / 1e6 : 0.0);
+            if (clock_name && best_cycles > 0) {
+                printf("%11.3f\n", (double)sizes[s] / best_cycles);
+            } else {
+                printf("%11s\n", "-");
+            }
+            fflush(stdout);
+        }
+    }
+    free(data);
+    return rc;
+}
@@ -0,0 +1,212 @@
+#include "dhash_modes.h"
+#include "dhash_throttle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <omp.h>
+
+#define CDC_MIN_BUFFER (8 << 20)
+
+// Gear table for the rolling hash; fixed so chunk boundaries are reproducible
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+static void build_gear(void) {
+    uint64_t x = 0x6468617368636463ULL;  // "dhashcdc"
+    for (int i = 0; i < 256; i++) {
+        // splitmix64
+        x += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+// n one-bits in the top of the word, where gear hashing mixes best
+static uint64_t top_mask(int n) {
+    if (n <= 0) return 0;
+    if (n >= 64) return ~0ULL;
+    return ((1ULL << n) - 1) << (64 - n);
+}
+
+int dhash_cdc_init(dhash_cdc_params* cp, size_t min_size, size_t avg_size, size_t max_size) {
+    if (min_size == 0 || min_size > avg_size || avg_size > max_size) {
+        fprintf(stderr, "Invalid CDC sizes: need 0 < min <= avg <= max\n");
+        return -1;
+    }
+    pthread_once(&gear_once, build_gear);
+
+    int bits = 0;
+    while (((size_t)1 << (bits + 1)) <= avg_size) bits++;
+
+    // FastCDC normalised chunking: a harder mask before avg, an easier one after
+    cp->min_size = min_size;
+    cp->avg_size = avg_size;
+    cp->max_size = max_size;
+    cp->mask_s = top_mask(bits + 2);
+    cp->mask_l = top_mask(bits - 2);
+    return 0;
+}
+
+size_t dhash_cdc_cut(const dhash_cdc_params* cp, const uint8_t* data, size_t len) {
+    if (len <= cp->min_size) return len;
+    size_t limit = len < cp->max_size ? len : cp->max_size;
+    size_t normal = cp->avg_size < limit ? cp->avg_size : limit;
+    uint64_t fp = 0;
+    size_t i = cp->min_size;
+
+    for (; i < normal; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & cp->mask_s)) return i + 1;
+    }
+    for (; i < limit; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & cp->mask_l)) return i + 1;
+    }
+    return limit;
+}
+
+typedef struct {
+    size_t start;   // offset in the buffer
+    size_t len;
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t digest_len;
+    int error;
+} cdc_chunk;
+
+int dhash_cdc_file(const char* filename, const dhash_opts* opts, const dhash_cdc_params* cp) {
+    int is_stdin = strcmp(filename, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return 1;
+    }
+
+    size_t cap = 4 * cp->max_size;
+    if (cap < CDC_MIN_BUFFER) cap = CDC_MIN_BUFFER;
+    // Room for twice the average count per fill; grown if a fill cuts more
+    size_t chunk_cap = 2 * (cap / cp->avg_size) + 16;
+    int workers = opts->max_workers;
+
+    // Chunks are digested one per thread, so each context runs single-threaded
+    dhash_opts chunk_opts = *opts;
+    chunk_opts.max_workers = 1;
+    // Throttle on the whole-file context only, so each byte is counted once
+    dhash_opts file_opts = chunk_opts;
+    chunk_opts.throttle = NULL;
+
+    uint8_t* buffer = malloc(cap);
+    cdc_chunk* chunks = malloc(chunk_cap * sizeof(*chunks));
+    dhash_ctx** ctxs = calloc(workers, sizeof(*ctxs));
+    dhash_ctx* file_ctx = dhash_ctx_new(&file_opts);
+    int rc = 0;
+
+    if (!buffer || !chunks || !ctxs || !file_ctx) {
+        fprintf(stderr, "Failed to allocate CDC buffers\n");
+        rc = 1;
+        goto out;
+    }
+    for (int w = 0; w < workers; w++) {
+        if (!(ctxs[w] = dhash_ctx_new(&chunk_opts))) {
+            rc = 1;
+            goto out;
+        }
+    }
+
+    size_t have = 0;
+    uint64_t base = 0;  // file offset of buffer[0]
+    int eof = 0;
+    char hex[DHASH_FORMAT_MAX];
+
+    while (!eof || have > 0) {
+        while (!eof && have < cap) {
+            ssize_t n = read(fd, buffer + have, cap - have);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("Failed to read file");
+                rc = 1;
+                goto out;
+            }
+            if (n == 0) eof = 1;
+            have += (size_t)n;
+            dhash_throttle_read(opts->throttle, (size_t)n);
+        }
+
+        // Cut every chunk whose end is certain; keep a partial tail for the next fill
+        size_t nchunks = 0;
+        size_t pos = 0;
+        while (pos < have && (eof || have - pos >= cp->max_size)) {
+            size_t len = dhash_cdc_cut(cp, buffer + pos, have - pos);
+            if (nchunks == chunk_cap) {
+                cdc_chunk* more = realloc(chunks, 2 * chunk_cap * sizeof(*chunks));
+                if (!more) {
+                    fprintf(stderr, "Failed to allocate CDC chunks\n");
+                    rc = 1;
+                    goto out;
+                }
+                chunks = more;
+                chunk_cap *= 2;
+            }
+            chunks[nchunks].start = pos;
+            chunks[nchunks].len = len;
+            nchunks++;
+            pos += len;
+        }
+
+        // Iteration nchunks feeds the whole-file digest alongside the chunk digests
+#pragma omp parallel for schedule(dynamic) num_threads(workers)
+        for (size_t j = 0; j <= nchunks; j++) {
+            if (j == nchunks) {
+                if (dhash_update(file_ctx, buffer, pos) != 0) {
+#pragma omp atomic write
+                    rc = 1;
+                }
+                continue;
+            }
+            dhash_ctx* ctx = ctxs[omp_get_thread_num()];
+            cdc_chunk* ch = &chunks[j];
+            ch->error = dhash_ctx_reset(ctx) != 0
+                     || dhash_update(ctx, buffer + ch->start, ch->len) != 0
+                     || dhash_final(ctx, ch->digest, &ch->digest_len) != 0;
+        }
+
+        for (size_t j = 0; j < nchunks; j++) {
+            if (chunks[j].error) {
+                rc = 1;
+                goto out;
+            }
+            dhash_format(opts, chunks[j].digest, chunks[j].digest_len, hex);
+            printf("%llu %zu %s\n", (unsigned long long)(base + chunks[j].start), chunks[j].len, hex);
+        }
+        if (rc != 0) goto out;
+
+        memmove(buffer, buffer + pos, have - pos);
+        have -= pos;
+        base += pos;
+    }
+
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t digest_len = 0;
+    if (dhash_final(file_ctx, digest, &digest_len) != 0) {
+        rc = 1;
+        goto out;
+    }
+    dhash_format(opts, digest, digest_len, hex);
+    printf("%s  %s\n", hex, filename);
+
+out:
+    if (ctxs) {
+        for (int w = 0; w < workers; w++) dhash_ctx_free(ctxs[w]);
+    }
+    free(ctxs);
+    dhash_ctx_free(file_ctx);
+    free(chunks);
+    free(buffer);
+    if (!is_stdin) close(fd);
+    return rc;
+}
@@ -0,0 +1,245 @@
+// dhash-client: pipelines hash requests to a running "dhash --daemon"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "dhash_modes.h"
+
+enum send_mode { SEND_PATH, SEND_FD, SEND_INLINE };
+
+static struct {
+    int sock;
+    enum send_mode mode;
+    int bits;
+    unsigned long long chunk_size;
+    int algo;
+    int stats;
+    char** files;
+    int nfiles;
+    int expected;   // replies the receiver should wait for
+    int send_failed;
+} client;
+
+static int send_all(const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t n = send(client.sock, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Send the request line with fd attached as SCM_RIGHTS ancillary data
+static int send_with_fd(const char* line, size_t len, int fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { (void*)line, len };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+    ssize_t n;
+    do {
+        n = sendmsg(client.sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    return send_all(line + n, len - (size_t)n);
+}
+
+static int send_request(int id) {
+    const char* path = client.files[id];
+    char line[4096 + 128];
+    int len;
+
+    if (client.mode == SEND_PATH) {
+        char resolved[PATH_MAX];
+        if (!realpath(path, resolved)) {
+            perror(path);
+            return -1;
+        }
+        len = snprintf(line, sizeof(line), "%d PATH %d %llu rc%d %s\n", id, client.bits, client.chunk_size,
+                       client.algo, resolved);
+        return send_all(line, len);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    int rc;
+    if (client.mode == SEND_FD) {
+        len = snprintf(line, sizeof(line), "%d FD %d %llu rc%d\n", id, client.bits, client.chunk_size, client.algo);
+        rc = send_with_fd(line, len, fd);
+    } else {
+        struct stat st;
+        void* map = NULL;
+        rc = fstat(fd, &st);
+        if (rc == 0 && st.st_size > 0) {
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) rc = -1;
+        }
+        if (rc == 0) {
+            len = snprintf(line, sizeof(line), "%d DATA %d %llu rc%d %lld\n", id, client.bits, client.chunk_size,
+                           client.algo, (long long)st.st_size);
+            rc = send_all(line, len);
+            if (rc == 0 && st.st_size > 0) rc = send_all(map, st.st_size);
+        }
+        if (map && map != MAP_FAILED) munmap(map, st.st_size);
+    }
+    close(fd);
+    return rc;
+}
+
+static void* sender_main(void* arg) {
+    (void)arg;
+    for (int i = 0; i < client.nfiles; i++) {
+        if (send_request(i) != 0) {
+            // Tell the receiver not to wait for this one
+            __atomic_sub_fetch(&client.expected, 1, __ATOMIC_SEQ_CST);
+            client.send_failed = 1;
+        }
+    }
+    if (client.stats) send_all("stats STATS\n", 12);
+    shutdown(client.sock, SHUT_WR);
+    return NULL;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [--socket PATH] [--send path|fd|inline] [--bits N] [--chunk-size N] [--algo rcN]\n"
+            "       [--stats] [file...]\n"
+            "The default socket is " DHASH_DEFAULT_SOCKET ".\n",
+            prog);
+}
+
+int main(int argc, char* argv[]) {
+    const char* socket_path = NULL;
+    char default_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    client.mode = SEND_FD;
+    client.bits = DHASH_DEFAULT_BITS;
+    client.chunk_size = DHASH_DEFAULT_CHUNK;
+    client.algo = DHASH_DEFAULT_ALGO;
+    client.files = calloc(argc, sizeof(char*));
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--socket") == 0 && value) {
+            socket_path = value;
+            i++;
+        } else if (strcmp(argv[i], "--send") == 0 && value) {
+            if (strcmp(value, "path") == 0) client.mode = SEND_PATH;
+            else if (strcmp(value, "fd") == 0) client.mode = SEND_FD;
+            else if (strcmp(value, "inline") == 0) client.mode = SEND_INLINE;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--bits") == 0 && value) {
+            client.bits = atoi(value);
+            i++;
+        } else if (strcmp(argv[i], "--chunk-size") == 0 && value) {
+            client.chunk_size = strtoull(value, NULL, 10);
+            i++;
+        } else if (strcmp(argv[i], "--algo") == 0 && value) {
+            // rc1..rc5, or the bare number, as dhash --algo takes it
+            const char* v = value;
+            if ((v[0] == 'r' || v[0] == 'R') && (v[1] == 'c' || v[1] == 'C')) v += 2;
+            if (v[0] < '1' || v[0] > '5' || v[1] != '\0') {
+                usage(argv[0]);
+                return 1;
+            }
+            client.algo = v[0] - '0';
+            i++;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            client.stats = 1;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            client.files[client.nfiles++] = argv[i];
+        }
+    }
+    if (client.nfiles == 0 && !client.stats) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!socket_path) {
+        dhash_default_socket(default_path, sizeof(default_path));
+        socket_path = default_path;
+    }
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    client.sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (client.sock < 0 || connect(client.sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(socket_path);
+        return 1;
+    }
+    client.expected = client.nfiles + client.stats;
+
+    pthread_t sender;
+    if (pthread_create(&sender, NULL, sender_main, NULL) != 0) {
+        perror("Failed to start sender");
+        return 1;
+    }
+
+    // Replies come back in completion order, tagged with the request id
+    FILE* in = fdopen(client.sock, "r");
+    char line[4096];
+    int received = 0, rc = 0;
+    while (received < __atomic_load_n(&client.expected, __ATOMIC_SEQ_CST) && fgets(line, sizeof(line), in)) {
+        char id[64], status[16];
+        int consumed = 0;
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%63s %15s %n", id, status, &consumed) < 2) continue;
+        received++;
+        if (strcmp(status, "STATS") == 0) {
+            printf("%s\n", line + consumed);
+            continue;
+        }
+        int idx = atoi(id);
+        const char* path = (idx >= 0 && idx < client.nfiles) ? client.files[idx] : "?";
+        if (strcmp(status, "OK") == 0) {
+            printf("%s  %s\n", line + consumed, path);
+        } else {
+            fprintf(stderr, "%s: %s\n", path, line + consumed);
+            rc = 1;
+        }
+    }
+    pthread_join(sender, NULL);
+    if (client.send_failed) rc = 1;
+    if (received < client.expected) {
+        fprintf(stderr, "Daemon closed the connection early\n");
+        rc = 1;
+    }
+    fclose(in);
+    free(client.files);
+    return rc;
+}
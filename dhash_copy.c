@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include "dhash_modes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#define COPY_READ_SLOTS 4
+
+static int write_full(int fd, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Pipe input: tee() duplicates what is queued in the pipe into a private
+// pipe, splice() moves the original to the destination inside the kernel and
+// only the duplicate is read for hashing. Returns 1, having consumed nothing,
+// when the kernel cannot splice between these descriptors.
+static int copy_tee(int in, int out, dhash_ctx* ctx, uint8_t* buf, size_t size) {
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) != 0) return 1;
+    // Bigger pipes mean fewer tee/splice round trips; unprivileged users are
+    // capped by /proc/sys/fs/pipe-max-size, so failures are fine
+    int want = (int)(size < (1u << 20) ? size : (1u << 20));
+    fcntl(in, F_SETPIPE_SZ, want);
+    fcntl(p[1], F_SETPIPE_SZ, want);
+    int cap = fcntl(p[1], F_GETPIPE_SZ);
+    if (cap <= 0) cap = 65536;
+
+    int rc = 0;
+    int first = 1;
+    for (;;) {
+        ssize_t n = tee(in, p[1], (size_t)cap, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            rc = first ? 1 : -1;
+            if (rc < 0) perror("tee");
+            break;
+        }
+        if (n == 0) break;
+
+        for (ssize_t moved = 0; moved < n;) {
+            ssize_t m = splice(in, NULL, out, NULL, (size_t)(n - moved), SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) {
+                if (first && moved == 0) {
+                    rc = 1;  // nothing consumed; the caller copies through user space
+                } else {
+                    perror("splice");
+                    rc = -1;
+                }
+                break;
+            }
+            moved += m;
+        }
+        if (rc != 0) break;
+        first = 0;
+
+        for (ssize_t got = 0; got < n;) {
+            size_t len = (size_t)(n - got) < size ? (size_t)(n - got) : size;
+            ssize_t m = read(p[0], buf, len);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0 || dhash_update(ctx, buf, (size_t)m) != 0) {
+                rc = -1;
+                break;
+            }
+            got += m;
+        }
+        if (rc != 0) break;
+    }
+    close(p[0]);
+    close(p[1]);
+    return rc;
+}
+
+// Everything else: a read-ahead thread fills the ring while one thread hashes
+// a block and another writes that same block, so the destination holds exactly
+// the bytes that were digested
+static int copy_blocks(int in, int out, dhash_ctx* ctx, const dhash_opts* opts, int fsync_dest) {
+    dhash_reader* reader = dhash_reader_start(in, opts, COPY_READ_SLOTS);
+    if (!reader) return -1;
+    int direct = (fcntl(out, F_GETFL) & O_DIRECT) != 0;
+    off_t written = 0;
+    int rc = 0;
+
+    while (rc == 0) {
+        const uint8_t* data;
+        ssize_t n = dhash_reader_next(reader, &data);
+        if (n < 0) rc = -1;
+        if (n <= 0) break;
+        // O_DIRECT needs whole blocks; only the final, short block is unaligned
+        if (direct && n % DHASH_IO_ALIGN != 0) {
+            fcntl(out, F_SETFL, fcntl(out, F_GETFL) & ~O_DIRECT);
+            direct = 0;
+        }
+        int hash_error = 0, write_error = 0;
+#pragma omp parallel sections num_threads(2)
+        {
+#pragma omp section
+            hash_error = dhash_update(ctx, data, (size_t)n) != 0;
+#pragma omp section
+            write_error = write_full(out, data, (size_t)n) != 0;
+        }
+        if (write_error) perror("Failed to write copy");
+        if (hash_error || write_error) rc = -1;
+        // Start writeback now so the final fdatasync does not wait for all of it
+        if (rc == 0 && fsync_dest && !direct) {
+            sync_file_range(out, written, n, SYNC_FILE_RANGE_WRITE);
+        }
+        written += n;
+    }
+    dhash_reader_stop(reader);
+    return rc;
+}
+
+static int open_dest(const char* dest, const dhash_opts* opts) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if (opts->direct_io) {
+        int fd = open(dest, flags | O_DIRECT, 0666);
+        if (fd >= 0 || errno != EINVAL) return fd;
+    }
+    return open(dest, flags, 0666);
+}
+
+// A new file's name is only durable once its directory is
+static int sync_parent(const char* dest) {
+    char* copy = strdup(dest);
+    if (!copy) return -1;
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(copy);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+int dhash_copy_file(const char* src, const char* dest, const dhash_opts* opts, int fsync_dest,
+                    unsigned char* out, size_t* out_len) {
+    int is_stdin = strcmp(src, "-") == 0;
+    int in = is_stdin ? STDIN_FILENO : dhash_open_input(src, opts);
+    if (in < 0) {
+        perror(src);
+        return -1;
+    }
+    struct stat in_st, out_st;
+    if (fstat(in, &in_st) != 0) {
+        perror(src);
+        if (!is_stdin) close(in);
+        return -1;
+    }
+    // Truncating the destination must never truncate the source
+    if (stat(dest, &out_st) == 0 && out_st.st_dev == in_st.st_dev && out_st.st_ino == in_st.st_ino) {
+        fprintf(stderr, "%s and %s are the same file\n", src, dest);
+        if (!is_stdin) close(in);
+        return -1;
+    }
+    int fd = open_dest(dest, opts);
+    if (fd < 0) {
+        perror(dest);
+        if (!is_stdin) close(in);
+        return -1;
+    }
+    int regular = fstat(fd, &out_st) == 0 && S_ISREG(out_st.st_mode);
+
+    dhash_ctx* ctx = dhash_ctx_new(opts);
+    dhash_buffer buf = { 0 };
+    int rc = ctx ? 1 : -1;
+    if (rc > 0 && S_ISFIFO(in_st.st_mode) && !(fcntl(fd, F_GETFL) & O_DIRECT)
+        && dhash_buffer_alloc(&buf, dhash_io_block_size(opts), opts->huge_pages) == 0) {
+        rc = copy_tee(in, fd, ctx, buf.data, buf.size);
+    }
+    if (rc > 0) rc = copy_blocks(in, fd, ctx, opts, fsync_dest);
+    if (rc == 0 && fsync_dest && regular && (fdatasync(fd) != 0 || sync_parent(dest) != 0)) {
+        perror(dest);
+        rc = -1;
+    }
+    if (close(fd) != 0 && rc == 0) {
+        perror(dest);
+        rc = -1;
+    }
+    if (rc == 0) rc = dhash_final(ctx, out, out_len);
+    // Do not leave a partial copy that looks like a finished one
+    if (rc != 0 && regular) unlink(dest);
+
+    dhash_buffer_free(&buf);
+    dhash_ctx_free(ctx);
+    if (!is_stdin) close(in);
+    return rc;
+}
@@ -0,0 +1,565 @@
+#define _GNU_SOURCE
+#include "dhash_modes.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Bounded so a fast client is throttled instead of growing the queue without limit
+#define DAEMON_QUEUE_MAX 1024
+#define DAEMON_MAX_INLINE (256u << 20)
+// Inline DATA held by queued and running jobs; a reader waits for room before
+// reading the payload, so its client stalls rather than the daemon's memory growing
+#define DAEMON_INLINE_BUDGET (4ull * DAEMON_MAX_INLINE)
+#define DAEMON_LINE_MAX 4096
+#define DAEMON_READ_BUF 65536
+#define DAEMON_MAX_FDS 64
+
+typedef struct conn {
+    int sock;
+    pthread_mutex_t write_lock;
+    pthread_mutex_t ref_lock;
+    int refs;               // reader thread + queued/running jobs
+    int fds[DAEMON_MAX_FDS];  // descriptors received with SCM_RIGHTS, in order
+    int nfds;
+    char buf[DAEMON_READ_BUF];
+    size_t head, tail;
+} conn;
+
+enum job_kind { JOB_PATH, JOB_FD, JOB_DATA };
+
+typedef struct job {
+    struct job* next;
+    conn* c;
+    enum job_kind kind;
+    char id[64];
+    dhash_opts opts;
+    char* path;
+    int fd;
+    uint8_t* data;
+    size_t len;
+    size_t reserved;  // share of DAEMON_INLINE_BUDGET, returned by job_free
+} job;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t inline_room;
+    job* head;
+    job* tail;
+    int queued;
+    int in_flight;
+    unsigned long long inline_bytes;
+    int connections;
+    unsigned long long served;
+    unsigned long long failed;
+    dhash_opts defaults;
+    dhash_metrics* metrics;
+} daemon_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+    .inline_room = PTHREAD_COND_INITIALIZER,
+};
+
+static const char* socket_path;
+
+static void conn_release(conn* c) {
+    pthread_mutex_lock(&c->ref_lock);
+    int refs = --c->refs;
+    pthread_mutex_unlock(&c->ref_lock);
+    if (refs > 0) return;
+
+    for (int i = 0; i < c->nfds; i++) close(c->fds[i]);
+    close(c->sock);
+    pthread_mutex_destroy(&c->write_lock);
+    pthread_mutex_destroy(&c->ref_lock);
+    free(c);
+
+    pthread_mutex_lock(&daemon_state.lock);
+    daemon_state.connections--;
+    pthread_mutex_unlock(&daemon_state.lock);
+}
+
+static void conn_reply(conn* c, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void conn_reply(conn* c, const char* fmt, ...) {
+    char line[2 * DHASH_MAX_DIGEST + 256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if ((size_t)len >= sizeof(line)) len = sizeof(line) - 1;
+
+    pthread_mutex_lock(&c->write_lock);
+    size_t off = 0;
+    while (off < (size_t)len) {
+        ssize_t n = send(c->sock, line + off, len - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;  // client went away; its reader will notice
+        }
+        off += (size_t)n;
+    }
+    pthread_mutex_unlock(&c->write_lock);
+}
+
+// Read more bytes into the connection buffer, collecting any passed descriptors
+static int conn_fill(conn* c) {
+    if (c->head > 0) {
+        memmove(c->buf, c->buf + c->head, c->tail - c->head);
+        c->tail -= c->head;
+        c->head = 0;
+    }
+    if (c->tail == sizeof(c->buf)) return -1;
+
+    char control[CMSG_SPACE(sizeof(int) * DAEMON_MAX_FDS)];
+    struct iovec iov = { c->buf + c->tail, sizeof(c->buf) - c->tail };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return -1;
+
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        int count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* fds = (int*)CMSG_DATA(cm);
+        for (int i = 0; i < count; i++) {
+            if (c->nfds < DAEMON_MAX_FDS) c->fds[c->nfds++] = fds[i];
+            else close(fds[i]);
+        }
+    }
+    c->tail += (size_t)n;
+    return 0;
+}
+
+static int conn_read_line(conn* c, char* line, size_t cap) {
+    for (;;) {
+        char* nl = memchr(c->buf + c->head, '\n', c->tail - c->head);
+        if (nl) {
+            size_t len = (size_t)(nl - (c->buf + c->head));
+            if (len >= cap) return -1;
+            memcpy(line, c->buf + c->head, len);
+            line[len] = '\0';
+            c->head += len + 1;
+            return 0;
+        }
+        if (conn_fill(c) != 0) return -1;
+    }
+}
+
+static int conn_read_exact(conn* c, uint8_t* out, size_t len) {
+    while (len > 0) {
+        if (c->head == c->tail && conn_fill(c) != 0) return -1;
+        size_t n = c->tail - c->head;
+        if (n > len) n = len;
+        memcpy(out, c->buf + c->head, n);
+        c->head += n;
+        out += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int conn_take_fd(conn* c) {
+    if (c->nfds == 0) return -1;
+    int fd = c->fds[0];
+    memmove(c->fds, c->fds + 1, (c->nfds - 1) * sizeof(int));
+    c->nfds--;
+    return fd;
+}
+
+static void inline_reserve(job* j, size_t len) {
+    pthread_mutex_lock(&daemon_state.lock);
+    while (daemon_state.inline_bytes + len > DAEMON_INLINE_BUDGET) {
+        pthread_cond_wait(&daemon_state.inline_room, &daemon_state.lock);
+    }
+    daemon_state.inline_bytes += len;
+    pthread_mutex_unlock(&daemon_state.lock);
+    j->reserved = len;
+}
+
+static void job_free(job* j) {
+    if (j->reserved) {
+        pthread_mutex_lock(&daemon_state.lock);
+        daemon_state.inline_bytes -= j->reserved;
+        pthread_cond_broadcast(&daemon_state.inline_room);
+        pthread_mutex_unlock(&daemon_state.lock);
+    }
+    if (j->fd >= 0) close(j->fd);
+    free(j->path);
+    free(j->data);
+    free(j);
+}
+
+static void queue_push(job* j) {
+    pthread_mutex_lock(&daemon_state.lock);
+    while (daemon_state.queued >= DAEMON_QUEUE_MAX) {
+        pthread_cond_wait(&daemon_state.not_full, &daemon_state.lock);
+    }
+    j->next = NULL;
+    if (daemon_state.tail) daemon_state.tail->next = j;
+    else daemon_state.head = j;
+    daemon_state.tail = j;
+    daemon_state.queued++;
+    dhash_metrics_queue(daemon_state.metrics, daemon_state.queued, daemon_state.in_flight);
+    pthread_cond_signal(&daemon_state.not_empty);
+    pthread_mutex_unlock(&daemon_state.lock);
+}
+
+static job* queue_pop(void) {
+    pthread_mutex_lock(&daemon_state.lock);
+    while (!daemon_state.head) {
+        pthread_cond_wait(&daemon_state.not_empty, &daemon_state.lock);
+    }
+    job* j = daemon_state.head;
+    daemon_state.head = j->next;
+    if (!daemon_state.head) daemon_state.tail = NULL;
+    daemon_state.queued--;
+    daemon_state.in_flight++;
+    dhash_metrics_queue(daemon_state.metrics, daemon_state.queued, daemon_state.in_flight);
+    pthread_cond_signal(&daemon_state.not_full);
+    pthread_mutex_unlock(&daemon_state.lock);
+    return j;
+}
+
+// Each worker keeps its hash context and read buffer for the life of the daemon
+static void* worker_main(void* arg) {
+    (void)arg;
+    dhash_ctx* ctx = NULL;
+    dhash_buffer io_buffer;
+    if (dhash_buffer_alloc(&io_buffer, dhash_io_block_size(&daemon_state.defaults),
+                           daemon_state.defaults.huge_pages) != 0) {
+        exit(1);
+    }
+    uint8_t* buffer = io_buffer.data;
+    size_t buffer_size = io_buffer.size;
+
+    for (;;) {
+        job* j = queue_pop();
+        const char* err = NULL;
+        double t0 = dhash_metrics_now();
+        dhash_io_stats io = { 0 };
+
+        const dhash_opts* cur = ctx ? dhash_ctx_opts(ctx) : NULL;
+        if (!cur || cur->bits != j->opts.bits || cur->chunk_size != j->opts.chunk_size
+            || cur->algo != j->opts.algo) {
+            dhash_ctx_free(ctx);
+            ctx = dhash_ctx_new(&j->opts);
+        } else if (dhash_ctx_reset(ctx) != 0) {
+            dhash_ctx_free(ctx);
+            ctx = NULL;
+        } else {
+            dhash_metrics_cache_hit(daemon_state.metrics);
+        }
+        if (!ctx) err = "hash context unavailable";
+
+        if (!err && j->kind == JOB_PATH) {
+            j->fd = dhash_open_input(j->path, &j->opts);
+            if (j->fd < 0) err = strerror(errno);
+        }
+        if (!err) {
+            int rc;
+            if (j->kind == JOB_DATA) {
+                rc = dhash_update(ctx, j->data, j->len);
+                io.bytes = j->len;
+            } else {
+                rc = dhash_update_fd(ctx, j->fd, buffer, buffer_size, &io);
+            }
+            if (rc != 0) err = "read failed";
+        }
+
+        unsigned char digest[DHASH_MAX_DIGEST];
+        char formatted[DHASH_FORMAT_MAX];
+        size_t len = 0;
+        if (!err && dhash_final(ctx, digest, &len) != 0) err = "hash failed";
+        if (err) {
+            conn_reply(j->c, "%s ERR %s\n", j->id, err);
+        } else {
+            dhash_format(&j->opts, digest, len, formatted);
+            conn_reply(j->c, "%s OK %s\n", j->id, formatted);
+        }
+
+        dhash_metrics_record(daemon_state.metrics, io.bytes, dhash_metrics_now() - t0, io.read_seconds, !err);
+
+        pthread_mutex_lock(&daemon_state.lock);
+        daemon_state.in_flight--;
+        dhash_metrics_queue(daemon_state.metrics, daemon_state.queued, daemon_state.in_flight);
+        if (err) daemon_state.failed++;
+        else daemon_state.served++;
+        pthread_mutex_unlock(&daemon_state.lock);
+
+        conn_release(j->c);
+        job_free(j);
+    }
+    return NULL;
+}
+
+// Request lines: "<id> PATH <bits> <chunk_size> <algo> <path>", "<id> FD <bits> <chunk_size>
+// <algo>" (descriptor passed with SCM_RIGHTS), "<id> DATA <bits> <chunk_size> <algo> <len>"
+// followed by len raw bytes, and "<id> STATS". algo is rc1..rc5. Replies are "<id> OK
+// <digest>", formatted as dhash prints it (rcN: prefix for non-rc5), or "<id> ERR <reason>",
+// and may arrive in any order.
+static void* reader_main(void* arg) {
+    conn* c = arg;
+    char line[DAEMON_LINE_MAX];
+
+    while (conn_read_line(c, line, sizeof(line)) == 0) {
+        char id[64], cmd[16];
+        int consumed = 0;
+        if (sscanf(line, "%63s %15s %n", id, cmd, &consumed) < 2) {
+            conn_reply(c, "- ERR malformed request\n");
+            break;
+        }
+        const char* rest = line + consumed;
+
+        if (strcmp(cmd, "STATS") == 0) {
+            pthread_mutex_lock(&daemon_state.lock);
+            int in_flight = daemon_state.in_flight, queued = daemon_state.queued;
+            int connections = daemon_state.connections;
+            unsigned long long served = daemon_state.served, failed = daemon_state.failed;
+            unsigned long long inline_bytes = daemon_state.inline_bytes;
+            pthread_mutex_unlock(&daemon_state.lock);
+            conn_reply(c,
+                       "%s STATS in_flight=%d queued=%d connections=%d served=%llu failed=%llu"
+                       " inline_bytes=%llu\n",
+                       id, in_flight, queued, connections, served, failed, inline_bytes);
+            continue;
+        }
+
+        job* j = calloc(1, sizeof(*j));
+        if (!j) {
+            conn_reply(c, "%s ERR out of memory\n", id);
+            break;
+        }
+        snprintf(j->id, sizeof(j->id), "%s", id);
+        j->fd = -1;
+        j->opts = daemon_state.defaults;
+        j->opts.max_workers = 1;  // parallelism comes from the worker pool
+
+        int bits = 0, algo = 0, n = 0;
+        char algo_name[8];
+        unsigned long long chunk = 0, len = 0;
+        int fatal = 0;
+        if (sscanf(rest, "%d %llu %7s %n", &bits, &chunk, algo_name, &n) < 3) {
+            conn_reply(c, "%s ERR malformed request\n", id);
+            job_free(j);
+            break;
+        }
+        rest += n;
+        j->opts.bits = bits;
+        j->opts.chunk_size = (size_t)chunk;
+        int algo_ok = dhash_algo_parse(algo_name, &algo) == 0;
+        if (algo_ok) j->opts.algo = algo;
+
+        if (strcmp(cmd, "PATH") == 0 && *rest) {
+            j->kind = JOB_PATH;
+            j->path = strdup(rest);
+        } else if (strcmp(cmd, "FD") == 0) {
+            j->kind = JOB_FD;
+            j->fd = conn_take_fd(c);
+            if (j->fd < 0) {
+                conn_reply(c, "%s ERR no descriptor received\n", id);
+                job_free(j);
+                continue;
+            }
+        } else if (strcmp(cmd, "DATA") == 0 && sscanf(rest, "%llu", &len) == 1 && len <= DAEMON_MAX_INLINE) {
+            j->kind = JOB_DATA;
+            j->len = (size_t)len;
+            inline_reserve(j, j->len);
+            j->data = malloc(j->len ? j->len : 1);
+            fatal = !j->data || conn_read_exact(c, j->data, j->len) != 0;
+        } else {
+            conn_reply(c, "%s ERR malformed request\n", id);
+            job_free(j);
+            break;
+        }
+        if (fatal) {
+            job_free(j);
+            break;
+        }
+        if ((bits != 256 && bits != 512 && bits != 1024 && bits != 2048) || chunk == 0) {
+            conn_reply(c, "%s ERR unsupported bits or chunk size\n", id);
+            job_free(j);
+            continue;
+        }
+        if (!algo_ok) {
+            conn_reply(c, "%s ERR unsupported algo\n", id);
+            job_free(j);
+            continue;
+        }
+
+        pthread_mutex_lock(&c->ref_lock);
+        c->refs++;
+        pthread_mutex_unlock(&c->ref_lock);
+        j->c = c;
+        queue_push(j);
+    }
+
+    conn_release(c);
+    return NULL;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    if (socket_path) unlink(socket_path);
+    _exit(0);
+}
+
+// /run/dhash-<uid> for the default socket: created 0700, and refused unless it
+// is ours and closed to everyone else, so nobody else can plant or swap the socket
+static int prepare_default_dir(const char* path) {
+    char dir[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (!slash || slash == dir) return 0;
+    *slash = '\0';
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        perror(dir);
+        fprintf(stderr, "Set XDG_RUNTIME_DIR or pass --socket\n");
+        return -1;
+    }
+    struct stat st;
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077)) {
+        fprintf(stderr, "%s is not a directory private to this user\n", dir);
+        return -1;
+    }
+    return 0;
+}
+
+// Make way for bind(): a leftover socket of ours that nobody answers on is
+// removed; anything else at the path is left alone
+static int claim_socket_path(const struct sockaddr_un* addr) {
+    const char* path = addr->sun_path;
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        if (errno == ENOENT) return 0;
+        perror(path);
+        return -1;
+    }
+    if (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid()) {
+        fprintf(stderr, "%s exists and is not this user's socket; not replacing it\n", path);
+        return -1;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int live = probe >= 0 && connect(probe, (const struct sockaddr*)addr, sizeof(*addr)) == 0;
+    if (probe >= 0) close(probe);
+    if (live) {
+        fprintf(stderr, "A daemon is already serving %s\n", path);
+        return -1;
+    }
+    if (unlink(path) != 0 && errno != ENOENT) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+int dhash_daemon_run(const char* path, const dhash_opts* opts, dhash_metrics* metrics) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char default_path[sizeof(addr.sun_path)];
+    if (!path) {
+        if (dhash_default_socket(default_path, sizeof(default_path)) != 0) {
+            fprintf(stderr, "Default socket path too long; pass --socket\n");
+            return 1;
+        }
+        const char* runtime = getenv("XDG_RUNTIME_DIR");
+        if (!(runtime && *runtime) && prepare_default_dir(default_path) != 0) return 1;
+        path = default_path;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    dhash_init();
+    daemon_state.defaults = *opts;
+    daemon_state.metrics = metrics;
+
+    int lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lsock < 0) {
+        perror("socket");
+        return 1;
+    }
+    if (claim_socket_path(&addr) != 0) {
+        close(lsock);
+        return 1;
+    }
+    if (bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lsock, 128) != 0) {
+        perror(path);
+        close(lsock);
+        return 1;
+    }
+    socket_path = path;
+
+    struct sigaction sa = { 0 };
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (int w = 0; w < opts->max_workers; w++) {
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, worker_main, NULL) != 0) {
+            perror("Failed to start worker");
+            return 1;
+        }
+    }
+    fprintf(stderr, "dhash daemon listening on %s with %d workers\n", path, opts->max_workers);
+
+    for (;;) {
+        int sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+        conn* c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(sock);
+            continue;
+        }
+        c->sock = sock;
+        c->refs = 1;
+        pthread_mutex_init(&c->write_lock, NULL);
+        pthread_mutex_init(&c->ref_lock, NULL);
+
+        pthread_mutex_lock(&daemon_state.lock);
+        daemon_state.connections++;
+        pthread_mutex_unlock(&daemon_state.lock);
+
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, reader_main, c) != 0) {
+            perror("Failed to start connection reader");
+            conn_release(c);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    close(lsock);
+    unlink(path);
+    return 1;
+}
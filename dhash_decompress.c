@@ -0,0 +1,436 @@
+#include "dhash_modes.h"
+#include "dhash_throttle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <omp.h>
+#ifdef DHASH_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define DECODE_SLOTS 4
+#define RAW_SLOTS 4
+#define BATCH_BYTES (32 << 20)  // decompressed bytes per parallel batch
+
+typedef enum { FORMAT_PLAIN, FORMAT_GZIP, FORMAT_ZSTD } input_format;
+
+// A member or frame that decompresses on its own
+typedef struct {
+    uint64_t offset;
+    size_t csize;
+    size_t usize;
+} segment;
+
+typedef struct {
+    input_format format;
+    const dhash_opts* opts;
+    int fd;
+
+    // Sequential decoding of raw blocks from a read-ahead thread
+    dhash_reader* raw;
+    const uint8_t* in;
+    size_t in_len;
+    int raw_eof;
+    z_stream zs;
+    int zs_ready;
+    int member_done;
+    int finished;
+#ifdef DHASH_HAVE_ZSTD
+    ZSTD_DStream* zd;
+    size_t zd_hint;  // 0 once a frame has been completed
+#endif
+
+    // Parallel decoding of independent segments from a mapped file
+    const uint8_t* map;
+    size_t map_len;
+    segment* segs;
+    size_t nsegs;
+    size_t next_seg;
+    uint8_t* batch;
+    size_t batch_len;
+    size_t batch_pos;
+} decoder;
+
+static uint32_t le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static input_format detect(const uint8_t* p, size_t n) {
+    if (n >= 3 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8) return FORMAT_GZIP;
+    if (n >= 4 && le32(p) == 0xfd2fb528) return FORMAT_ZSTD;
+    return FORMAT_PLAIN;
+}
+
+// BGZF-style members (bgzip, and pigz/gzip variants that record the member
+// size in a "BC" extra field) can be located without inflating anything
+static size_t bgzf_member_size(const uint8_t* p, size_t n) {
+    if (n < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4)) return 0;
+    size_t xlen = (size_t)p[10] | (size_t)p[11] << 8;
+    if (12 + xlen > n) return 0;
+    for (size_t i = 12; i + 4 <= 12 + xlen;) {
+        size_t slen = (size_t)p[i + 2] | (size_t)p[i + 3] << 8;
+        if (p[i] == 'B' && p[i + 1] == 'C' && slen == 2 && i + 6 <= 12 + xlen) {
+            size_t size = ((size_t)p[i + 4] | (size_t)p[i + 5] << 8) + 1;
+            return size <= n && size >= 12 + xlen + 8 ? size : 0;
+        }
+        i += 4 + slen;
+    }
+    return 0;
+}
+
+// Split the mapping into independently decodable segments, or fail (-1) and
+// leave the input to the sequential decoder
+static int find_segments(decoder* d) {
+    size_t cap = 1024, n = 0;
+    segment* segs = malloc(cap * sizeof(*segs));
+    size_t off = 0;
+    while (segs && off < d->map_len) {
+        const uint8_t* p = d->map + off;
+        size_t left = d->map_len - off;
+        size_t csize = 0, usize = 0;
+        if (d->format == FORMAT_GZIP) {
+            csize = bgzf_member_size(p, left);
+            if (csize) usize = le32(p + csize - 4);
+#ifdef DHASH_HAVE_ZSTD
+        } else if (d->format == FORMAT_ZSTD) {
+            size_t c = ZSTD_findFrameCompressedSize(p, left);
+            unsigned long long u = ZSTD_getFrameContentSize(p, left);
+            if (!ZSTD_isError(c) && u != ZSTD_CONTENTSIZE_UNKNOWN && u != ZSTD_CONTENTSIZE_ERROR) {
+                csize = c;
+                usize = (size_t)u;
+            }
+#endif
+        }
+        if (csize == 0 || usize > BATCH_BYTES) break;
+        if (n == cap) {
+            segment* grown = realloc(segs, 2 * cap * sizeof(*segs));
+            if (!grown) break;
+            segs = grown;
+            cap *= 2;
+        }
+        segs[n].offset = off;
+        segs[n].csize = csize;
+        segs[n].usize = usize;
+        n++;
+        off += csize;
+    }
+    // A single segment gains nothing from the parallel path
+    if (!segs || off != d->map_len || n < 2) {
+        free(segs);
+        return -1;
+    }
+    d->segs = segs;
+    d->nsegs = n;
+    return 0;
+}
+
+static int decode_segment(const decoder* d, const segment* s, uint8_t* out) {
+    const uint8_t* in = d->map + s->offset;
+    if (d->format == FORMAT_GZIP) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) return -1;
+        zs.next_in = (Bytef*)in;
+        zs.avail_in = (uInt)s->csize;
+        zs.next_out = out;
+        zs.avail_out = (uInt)s->usize;
+        int ret = inflate(&zs, Z_FINISH);
+        int ok = ret == Z_STREAM_END && zs.avail_out == 0;
+        inflateEnd(&zs);
+        return ok ? 0 : -1;
+    }
+#ifdef DHASH_HAVE_ZSTD
+    size_t n = ZSTD_decompress(out, s->usize, in, s->csize);
+    return (!ZSTD_isError(n) && n == s->usize) ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+// Decode the next batch of segments, one per thread
+static int decode_batch(decoder* d) {
+    size_t first = d->next_seg, last = first, total = 0;
+    while (last < d->nsegs && (last == first || total + d->segs[last].usize <= BATCH_BYTES)) {
+        total += d->segs[last].usize;
+        last++;
+    }
+    size_t* starts = malloc((last - first) * sizeof(size_t));
+    if (!starts) return -1;
+    for (size_t i = first, pos = 0; i < last; i++) {
+        starts[i - first] = pos;
+        pos += d->segs[i].usize;
+    }
+
+    int error = 0;
+#pragma omp parallel for schedule(dynamic) num_threads(d->opts->max_workers)
+    for (size_t i = first; i < last; i++) {
+        if (decode_segment(d, &d->segs[i], d->batch + starts[i - first]) != 0) {
+#pragma omp atomic write
+            error = 1;
+        }
+    }
+    free(starts);
+    dhash_throttle_read(d->opts->throttle, (size_t)(d->segs[last - 1].offset + d->segs[last - 1].csize
+                                                     - d->segs[first].offset));
+    if (error) {
+        fprintf(stderr, "Corrupt compressed member at offset %llu\n", (unsigned long long)d->segs[first].offset);
+        return -1;
+    }
+    d->next_seg = last;
+    d->batch_len = total;
+    d->batch_pos = 0;
+    return 0;
+}
+
+static ssize_t fill_parallel(void* arg, uint8_t* buf, size_t size) {
+    decoder* d = arg;
+    size_t have = 0;
+    while (have < size) {
+        if (d->batch_pos == d->batch_len) {
+            if (d->next_seg == d->nsegs) break;
+            if (decode_batch(d) != 0) return -1;
+        }
+        size_t n = d->batch_len - d->batch_pos;
+        if (n > size - have) n = size - have;
+        memcpy(buf + have, d->batch + d->batch_pos, n);
+        d->batch_pos += n;
+        have += n;
+    }
+    return (ssize_t)have;
+}
+
+// Next compressed block; returns 0 once the input is exhausted
+static int next_input(decoder* d) {
+    if (d->in_len > 0) return 1;
+    if (d->raw_eof) return 0;
+    ssize_t n = dhash_reader_next(d->raw, &d->in);
+    if (n < 0) return -1;
+    if (n == 0) {
+        d->raw_eof = 1;
+        return 0;
+    }
+    d->in_len = (size_t)n;
+    return 1;
+}
+
+static ssize_t fill_gzip(decoder* d, uint8_t* buf, size_t size) {
+    d->zs.next_out = buf;
+    d->zs.avail_out = (uInt)size;
+    while (d->zs.avail_out > 0 && !d->finished) {
+        int more = next_input(d);
+        if (more < 0) return -1;
+        if (more == 0) {
+            if (!d->member_done) {
+                fprintf(stderr, "Unexpected end of gzip input\n");
+                return -1;
+            }
+            d->finished = 1;
+            break;
+        }
+        if (d->member_done) {
+            // Concatenated members continue the content; anything else is trailing garbage
+            if (d->in[0] != 0x1f) {
+                d->finished = 1;
+                break;
+            }
+            inflateReset(&d->zs);
+            d->member_done = 0;
+        }
+        d->zs.next_in = (Bytef*)d->in;
+        d->zs.avail_in = (uInt)d->in_len;
+        int ret = inflate(&d->zs, Z_NO_FLUSH);
+        d->in += d->in_len - d->zs.avail_in;
+        d->in_len = d->zs.avail_in;
+        if (ret == Z_STREAM_END) {
+            d->member_done = 1;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "Corrupt gzip input: %s\n", d->zs.msg ? d->zs.msg : "inflate failed");
+            return -1;
+        }
+    }
+    return (ssize_t)(size - d->zs.avail_out);
+}
+
+#ifdef DHASH_HAVE_ZSTD
+static ssize_t fill_zstd(decoder* d, uint8_t* buf, size_t size) {
+    ZSTD_outBuffer out = { buf, size, 0 };
+    while (out.pos < out.size) {
+        int more = next_input(d);
+        if (more < 0) return -1;
+        if (more == 0) {
+            if (d->zd_hint != 0) {
+                fprintf(stderr, "Unexpected end of zstd input\n");
+                return -1;
+            }
+            break;
+        }
+        ZSTD_inBuffer in = { d->in, d->in_len, 0 };
+        size_t ret = ZSTD_decompressStream(d->zd, &out, &in);
+        d->in += in.pos;
+        d->in_len -= in.pos;
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "Corrupt zstd input: %s\n", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        d->zd_hint = ret;
+    }
+    return (ssize_t)out.pos;
+}
+#endif
+
+static ssize_t fill_plain(decoder* d, uint8_t* buf, size_t size) {
+    size_t have = 0;
+    while (have < size) {
+        int more = next_input(d);
+        if (more < 0) return -1;
+        if (more == 0) break;
+        size_t n = d->in_len < size - have ? d->in_len : size - have;
+        memcpy(buf + have, d->in, n);
+        d->in += n;
+        d->in_len -= n;
+        have += n;
+    }
+    return (ssize_t)have;
+}
+
+static ssize_t fill_sequential(void* arg, uint8_t* buf, size_t size) {
+    decoder* d = arg;
+    switch (d->format) {
+        case FORMAT_GZIP:
+            return fill_gzip(d, buf, size);
+#ifdef DHASH_HAVE_ZSTD
+        case FORMAT_ZSTD:
+            return fill_zstd(d, buf, size);
+#endif
+        default:
+            return fill_plain(d, buf, size);
+    }
+}
+
+static void decoder_free(decoder* d) {
+    if (!d) return;
+    dhash_reader_stop(d->raw);
+    if (d->zs_ready) inflateEnd(&d->zs);
+#ifdef DHASH_HAVE_ZSTD
+    ZSTD_freeDStream(d->zd);
+#endif
+    if (d->map) munmap((void*)d->map, d->map_len);
+    free(d->segs);
+    free(d->batch);
+    free(d);
+}
+
+static decoder* decoder_new(int fd, const dhash_opts* opts) {
+    decoder* d = calloc(1, sizeof(*d));
+    if (!d) {
+        perror("Failed to allocate decoder");
+        return NULL;
+    }
+    d->fd = fd;
+    d->opts = opts;
+
+    // Regular files are mapped so members and frames can be decoded in parallel
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            d->map = map;
+            d->map_len = (size_t)st.st_size;
+            d->format = detect(d->map, d->map_len);
+            if (d->format != FORMAT_PLAIN && find_segments(d) == 0) {
+                d->batch = malloc(BATCH_BYTES);
+                if (d->batch) return d;
+                free(d->segs);
+                d->segs = NULL;
+            }
+            munmap(map, d->map_len);
+            d->map = NULL;
+        }
+    }
+
+    d->raw = dhash_reader_start(fd, opts, RAW_SLOTS);
+    if (!d->raw || next_input(d) < 0) {
+        decoder_free(d);
+        return NULL;
+    }
+    d->format = detect(d->in, d->in_len);
+    if (d->format == FORMAT_GZIP) {
+        if (inflateInit2(&d->zs, 16 + MAX_WBITS) != Z_OK) {
+            fprintf(stderr, "Failed to initialise zlib\n");
+            decoder_free(d);
+            return NULL;
+        }
+        d->zs_ready = 1;
+    } else if (d->format == FORMAT_ZSTD) {
+#ifdef DHASH_HAVE_ZSTD
+        d->zd = ZSTD_createDStream();
+        if (!d->zd || ZSTD_isError(ZSTD_initDStream(d->zd))) {
+            fprintf(stderr, "Failed to initialise zstd\n");
+            decoder_free(d);
+            return NULL;
+        }
+        d->zd_hint = 1;
+#else
+        fprintf(stderr, "zstd input needs a build with DHASH_HAVE_ZSTD (-DDHASH_HAVE_ZSTD -lzstd)\n");
+        decoder_free(d);
+        return NULL;
+#endif
+    }
+    return d;
+}
+
+dhash_reader* dhash_decompress_start(int fd, const dhash_opts* opts, void** handle) {
+    decoder* d = decoder_new(fd, opts);
+    if (!d) return NULL;
+    dhash_fill_fn fill = d->segs ? fill_parallel : fill_sequential;
+    dhash_opts out_opts = *opts;
+    out_opts.throttle = NULL;  // compressed reads are throttled, not their output
+    dhash_reader* r = dhash_reader_start_fn(fill, d, -1, &out_opts, DECODE_SLOTS);
+    if (!r) {
+        decoder_free(d);
+        return NULL;
+    }
+    *handle = d;
+    return r;
+}
+
+void dhash_decompress_stop(dhash_reader* r, void* handle) {
+    // The output thread uses the decoder, so it goes first
+    dhash_reader_stop(r);
+    decoder_free(handle);
+}
+
+int dhash_decompress_file(const char* filename, const dhash_opts* opts, unsigned char* out, size_t* out_len) {
+    int is_stdin = strcmp(filename, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return -1;
+    }
+    void* handle = NULL;
+    dhash_reader* r = dhash_decompress_start(fd, opts, &handle);
+    dhash_ctx* ctx = r ? dhash_ctx_new(opts) : NULL;
+    int rc = ctx ? 0 : -1;
+
+    // Reading, decompressing and hashing each run on their own thread(s)
+    while (rc == 0) {
+        const uint8_t* data;
+        ssize_t n = dhash_reader_next(r, &data);
+        if (n < 0) rc = -1;
+        if (n <= 0) break;
+        rc = dhash_update(ctx, data, (size_t)n);
+    }
+    if (rc == 0) rc = dhash_final(ctx, out, out_len);
+
+    dhash_ctx_free(ctx);
+    if (r) dhash_decompress_stop(r, handle);
+    if (!is_stdin) close(fd);
+    return rc;
+}
@@ -0,0 +1,187 @@
+#include "dhash_modes.h"
+#include "dhash_throttle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define DIFF_BLOCK (4 << 20)
+#define DIFF_ALIGN 4096
+
+typedef struct {
+    const char* path;
+    int fd;
+    uint8_t* block;
+    size_t len;       // bytes in block
+    uint64_t total;   // bytes read so far
+    int eof;
+    int error;
+    dhash_ctx* ctx;
+    dhash_throttle* throttle;
+} diff_side;
+
+// Offset of the first byte where a and b differ (want_equal == 0) or agree
+// (want_equal == 1), or n if there is none
+static size_t scan(const uint8_t* a, const uint8_t* b, size_t n, int want_equal) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (!want_equal) mask = ~mask & 0xffff;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < n; i++) {
+        if ((a[i] == b[i]) == want_equal) return i;
+    }
+    return n;
+}
+
+// Fill the block completely (short only at EOF) and feed it to the digest
+static void fill(diff_side* s) {
+    s->len = 0;
+    while (!s->eof && s->len < DIFF_BLOCK) {
+        ssize_t n = read(s->fd, s->block + s->len, DIFF_BLOCK - s->len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror(s->path);
+            s->error = 1;
+            return;
+        }
+        if (n == 0) s->eof = 1;
+        s->len += (size_t)n;
+        dhash_throttle_read(s->throttle, (size_t)n);
+    }
+    if (dhash_update(s->ctx, s->block, s->len) != 0) s->error = 1;
+}
+
+static int open_side(diff_side* s, const char* path, const dhash_opts* opts) {
+    memset(s, 0, sizeof(*s));
+    s->path = path;
+    // A dup keeps close_side the same for both sides
+    s->fd = strcmp(path, "-") == 0 ? dup(STDIN_FILENO) : open(path, O_RDONLY);
+    if (s->fd < 0) {
+        perror(path);
+        return -1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    if (posix_memalign((void**)&s->block, DIFF_ALIGN, DIFF_BLOCK) != 0) {
+        s->block = NULL;
+        fprintf(stderr, "Failed to allocate diff buffer\n");
+        return -1;
+    }
+    s->ctx = dhash_ctx_new(opts);
+    s->throttle = opts->throttle;
+    return s->ctx ? 0 : -1;
+}
+
+static void close_side(diff_side* s) {
+    if (s->fd >= 0) close(s->fd);
+    free(s->block);
+    dhash_ctx_free(s->ctx);
+}
+
+static void print_digest(diff_side* s) {
+    unsigned char digest[DHASH_MAX_DIGEST];
+    char hex[DHASH_FORMAT_MAX];
+    size_t len = 0;
+    if (dhash_final(s->ctx, digest, &len) != 0) {
+        s->error = 1;
+        return;
+    }
+    dhash_format(dhash_ctx_opts(s->ctx), digest, len, hex);
+    printf("%s  %s\n", hex, s->path);
+}
+
+int dhash_diff_files(const char* path_a, const char* path_b, const dhash_opts* opts, int report_all) {
+    // Each side digests on its own thread, so keep the transform single-threaded
+    dhash_opts side_opts = *opts;
+    side_opts.max_workers = 1;
+
+    diff_side a, b;
+    int ok_a = open_side(&a, path_a, &side_opts);
+    int ok_b = open_side(&b, path_b, &side_opts);
+    if (ok_a != 0 || ok_b != 0) {
+        close_side(&a);
+        close_side(&b);
+        return 2;
+    }
+
+    int differ = 0;
+    int in_region = 0;
+    uint64_t region_start = 0;
+
+    while (!a.error && !b.error && !(a.eof && b.eof)) {
+#pragma omp parallel sections num_threads(2)
+        {
+#pragma omp section
+            {
+                if (!a.eof) fill(&a);
+                else a.len = 0;
+            }
+#pragma omp section
+            {
+                if (!b.eof) fill(&b);
+                else b.len = 0;
+            }
+        }
+        if (a.error || b.error) break;
+
+        // Both sides read whole blocks, so block offsets line up until one side ends
+        uint64_t base = a.total;
+        size_t common = a.len < b.len ? a.len : b.len;
+        size_t i = 0;
+        while (i < common && (report_all || !differ)) {
+            if (!in_region) {
+                i += scan(a.block + i, b.block + i, common - i, 0);
+                if (i == common) break;
+                if (!differ && !report_all) {
+                    printf("first difference at offset %llu (0x%llx)\n",
+                           (unsigned long long)(base + i), (unsigned long long)(base + i));
+                }
+                differ = 1;
+                in_region = 1;
+                region_start = base + i;
+            } else {
+                i += scan(a.block + i, b.block + i, common - i, 1);
+                if (i == common) break;
+                printf("differ at offsets %llu-%llu (%llu bytes)\n", (unsigned long long)region_start,
+                       (unsigned long long)(base + i - 1), (unsigned long long)(base + i - region_start));
+                in_region = 0;
+            }
+        }
+        a.total += a.len;
+        b.total += b.len;
+    }
+
+    if (!a.error && !b.error) {
+        uint64_t common = a.total < b.total ? a.total : b.total;
+        if (in_region && report_all) {
+            printf("differ at offsets %llu-%llu (%llu bytes)\n", (unsigned long long)region_start,
+                   (unsigned long long)(common - 1), (unsigned long long)(common - region_start));
+        }
+        if (a.total != b.total) {
+            printf("EOF on %s after %llu bytes\n", a.total < b.total ? path_a : path_b,
+                   (unsigned long long)common);
+            differ = 1;
+        }
+        print_digest(&a);
+        print_digest(&b);
+        if (!differ) printf("identical\n");
+    }
+
+    int rc = (a.error || b.error) ? 2 : differ;
+    close_side(&a);
+    close_side(&b);
+    return rc;
+}
@@ -0,0 +1,496 @@
+// Differential fuzz and property test: every dhash code path against the rc5
+// reference in directional_hash_rc5.c, which is compiled in unchanged, and the
+// rc1-rc3 transform (--algo) against rc3's flatten() over the same table.
+//
+//   libFuzzer: clang -g -O1 -fsanitize=fuzzer,address -fopenmp -DDHASH_FUZZ_LIBFUZZER
+//                  dhash_fuzz.c dhash.c dhash_io.c dhash_numa.c dhash_throttle.c dhash_sketch.c -lcrypto
+//   AFL:       afl-fuzz -i seeds -o findings -- ./dhash_fuzz @@
+//   property:  ./dhash_fuzz [--iterations N] [--seed S]
+//
+// Any divergence prints the case and aborts.
+
+#define _GNU_SOURCE
+#define main rc5_main
+#include "directional_hash_rc5.c"
+#undef main
+#undef CHUNK_SIZE
+
+#include "dhash_numa.h"
+#include "dhash_sketch.h"
+#include "dhash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define FUZZ_MAX_INPUT (1 << 20)
+#define FUZZ_MAX_CHUNK 4096
+// dhash.c's PARALLEL_MIN_BYTES: shorter runs are transformed on one thread
+#define FUZZ_PARALLEL_MIN (256 << 10)
+
+static const int fuzz_bits[] = { 256, 512, 1024, 2048 };
+
+typedef struct {
+    uint64_t s;
+} rng;
+
+static uint64_t rng_next(rng* r) {
+    // splitmix64
+    uint64_t z = (r->s += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static size_t rng_range(rng* r, size_t lo, size_t hi) {
+    return lo + (size_t)(rng_next(r) % (hi - lo + 1));
+}
+
+static char input_path[4096];
+static char capture_path[4096];
+static int input_fd = -1;
+static int capture_fd = -1;
+
+static void fail(const char* what, const char* detail) {
+    fprintf(stderr, "dhash_fuzz: %s: %s\n", what, detail);
+    abort();
+}
+
+static void fuzz_cleanup(void) {
+    unlink(input_path);
+}
+
+static void fuzz_init(void) {
+    if (input_fd >= 0) return;
+    const char* tmpdir = getenv("TMPDIR");
+    if (!tmpdir || !*tmpdir) tmpdir = "/tmp";
+    snprintf(input_path, sizeof(input_path), "%s/dhash-fuzz-in-XXXXXX", tmpdir);
+    snprintf(capture_path, sizeof(capture_path), "%s/dhash-fuzz-out-XXXXXX", tmpdir);
+    input_fd = mkstemp(input_path);
+    capture_fd = mkstemp(capture_path);
+    if (input_fd < 0 || capture_fd < 0) fail("mkstemp", strerror(errno));
+    // The library opens the input by name, so only the capture file is unlinked now
+    unlink(capture_path);
+    atexit(fuzz_cleanup);
+    precompute_weighted_patterns();
+    dhash_init();
+}
+
+static void write_input(const uint8_t* data, size_t len) {
+    if (ftruncate(input_fd, 0) != 0) fail("ftruncate", strerror(errno));
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(input_fd, data + done, len - done, (off_t)done);
+        if (n <= 0) fail("pwrite", strerror(errno));
+        done += (size_t)n;
+    }
+}
+
+// Run rc5's directional_hash_file with stdout redirected and return its hex line
+static void reference_digest(int bits, int chunk, int workers, char* hex, size_t hex_len) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (saved < 0 || ftruncate(capture_fd, 0) != 0 || lseek(capture_fd, 0, SEEK_SET) != 0) {
+        fail("capture", strerror(errno));
+    }
+    dup2(capture_fd, STDOUT_FILENO);
+    directional_hash_file(input_path, bits, chunk, workers);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    ssize_t n = pread(capture_fd, hex, hex_len - 1, 0);
+    if (n <= 0) fail("reference", "no digest printed");
+    hex[n] = '\0';
+    hex[strcspn(hex, "\n")] = '\0';
+}
+
+// process_byte writes the bits as '0'/'1' characters, most significant first
+static uint8_t reference_byte(uint8_t byte, uint8_t prev, uint8_t next) {
+    char bits[9];
+    process_byte(byte, bits, prev, next);
+    uint8_t v = 0;
+    for (int i = 0; bits[i]; i++) v = (uint8_t)(v << 1 | (bits[i] == '1'));
+    return v;
+}
+
+static void expect(const char* path, const char* want, const unsigned char* digest, size_t len,
+                   int rc, const char* params) {
+    char hex[2 * DHASH_MAX_DIGEST + 1];
+    if (rc != 0) fail(path, "returned an error");
+    dhash_hex(digest, len, hex);
+    if (strcmp(hex, want) != 0) {
+        fprintf(stderr, "dhash_fuzz: %s diverges (%s)\n  rc5:   %s\n  dhash: %s\n", path, params, want, hex);
+        abort();
+    }
+}
+
+// rc1-rc3 flatten() reads the grid in the unrotated weighted order, which is
+// rc5's table with seed 0
+static uint8_t reference_plain_byte(uint8_t byte) {
+    char grid[3][3];
+    to_grid(byte, grid);
+    uint8_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        int r = precomputed_coords[byte][i][0], c = precomputed_coords[byte][i][1];
+        v = (uint8_t)(v << 1 | (grid[r][c] == '1'));
+    }
+    return v;
+}
+
+// rc3's directional_hash_file: every byte flattened on its own, then digested
+static void reference_plain_digest(const uint8_t* data, size_t len, int bits, char* hex) {
+    const EVP_MD* md = bits == 256 ? EVP_sha256() : bits == 512 ? EVP_sha512() : EVP_shake256();
+    unsigned char out[DHASH_MAX_DIGEST];
+    unsigned int n = bits / 8;
+    uint8_t* flat = malloc(len ? len : 1);
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (!flat || !ctx) fail("reference", "out of memory");
+    for (size_t i = 0; i < len; i++) flat[i] = reference_plain_byte(data[i]);
+    int ok = EVP_DigestInit_ex(ctx, md, NULL) == 1 && EVP_DigestUpdate(ctx, flat, len) == 1
+          && (bits > 512 ? EVP_DigestFinalXOF(ctx, out, n) : EVP_DigestFinal_ex(ctx, out, &n)) == 1;
+    if (!ok) fail("reference", "digest failed");
+    dhash_hex(out, n, hex);
+    EVP_MD_CTX_free(ctx);
+    free(flat);
+}
+
+// Streaming API with random update splits
+static int digest_splits(const uint8_t* data, size_t len, const dhash_opts* opts, rng* r,
+                         unsigned char* out, size_t* out_len) {
+    dhash_ctx* ctx = dhash_ctx_new(opts);
+    if (!ctx) return -1;
+    size_t pos = 0;
+    int rc = 0;
+    while (pos < len && rc == 0) {
+        // Mostly tiny splits, which hit the pending-byte and frame edge cases
+        size_t max = (rng_next(r) & 3) ? 16 : len - pos;
+        size_t n = rng_range(r, 0, max < len - pos ? max : len - pos);
+        rc = dhash_update(ctx, data + pos, n);
+        pos += n;
+    }
+    if (rc == 0) rc = dhash_final(ctx, out, out_len);
+    dhash_ctx_free(ctx);
+    return rc;
+}
+
+// dhash_transform_frames over random whole-chunk segments, out of order
+static int digest_frames(const uint8_t* data, size_t len, const dhash_opts* opts, rng* r,
+                         unsigned char* out, size_t* out_len) {
+    dhash_ctx* ctx = dhash_ctx_new(opts);
+    uint8_t* transformed = malloc(len ? len : 1);
+    size_t chunk = opts->chunk_size;
+    int rc = (!ctx || !transformed) ? -1 : 0;
+
+    // Cut points on chunk multiples, transformed back to front
+    size_t cuts[64];
+    int ncuts = 0;
+    cuts[ncuts++] = 0;
+    for (size_t pos = 0; rc == 0 && pos < len && ncuts < 63;) {
+        pos += rng_range(r, 1, 8) * chunk;
+        if (pos < len) cuts[ncuts++] = pos;
+    }
+    cuts[ncuts] = len;
+    for (int k = ncuts - 1; rc == 0 && k >= 0; k--) {
+        size_t a = cuts[k], n = cuts[k + 1] - a;
+        dhash_transform_frames(data + a, n, a, chunk, a ? data[a - 1] : 0, transformed + a);
+    }
+    if (rc == 0 && len > 0) {
+        size_t split = rng_range(r, 0, len);
+        rc = dhash_update_transformed(ctx, transformed, split)
+          || dhash_update_transformed(ctx, transformed + split, len - split);
+    }
+    if (rc == 0) rc = dhash_final(ctx, out, out_len);
+    free(transformed);
+    dhash_ctx_free(ctx);
+    return rc;
+}
+
+// dhash_update in runs of at least FUZZ_PARALLEL_MIN, so each one is split
+// across the workers; most end on a frame edge, some a byte either side
+static int digest_runs(const uint8_t* data, size_t len, const dhash_opts* opts, rng* r,
+                       unsigned char* out, size_t* out_len) {
+    dhash_ctx* ctx = dhash_ctx_new(opts);
+    if (!ctx) return -1;
+    size_t chunk = opts->chunk_size, pos = 0;
+    int rc = 0;
+    while (pos < len && rc == 0) {
+        size_t n = (FUZZ_PARALLEL_MIN + chunk - 1) / chunk * chunk + rng_range(r, 0, 64) * chunk;
+        if ((rng_next(r) & 3) == 0) n += (rng_next(r) & 1) ? 1 : -1;
+        if (n > len - pos) n = len - pos;
+        rc = dhash_update(ctx, data + pos, n);
+        pos += n;
+    }
+    if (rc == 0) rc = dhash_final(ctx, out, out_len);
+    dhash_ctx_free(ctx);
+    return rc;
+}
+
+// Random fragments, empty ones included, for dhash_hash_iov; returns the count
+static int fragment(const uint8_t* data, size_t len, rng* r, struct iovec* iov, int max) {
+    int n = 0;
+    size_t pos = 0;
+    while (pos < len && n < max - 1) {
+        size_t take = rng_range(r, 0, (rng_next(r) & 3) ? 16 : len - pos);
+        if (take > len - pos) take = len - pos;
+        iov[n].iov_base = (void*)(data + pos);
+        iov[n++].iov_len = take;
+        pos += take;
+    }
+    iov[n].iov_base = (void*)(data + pos);
+    iov[n++].iov_len = len - pos;
+    return n;
+}
+
+// dhash_hash_many with the input as several objects: fragmented, whole, and
+// again fragmented differently; every one must give the same digest
+static int digest_many(const uint8_t* data, size_t len, const dhash_opts* opts, rng* r,
+                       unsigned char* out, size_t* out_len) {
+    static struct iovec iov[2][256];
+    struct iovec whole = { (void*)data, len };
+    dhash_object objects[3];
+    memset(objects, 0, sizeof(objects));
+    objects[0].iov = iov[0];
+    objects[0].iovcnt = fragment(data, len, r, iov[0], 256);
+    objects[1].iov = &whole;
+    objects[1].iovcnt = 1;
+    objects[2].iov = iov[1];
+    objects[2].iovcnt = fragment(data, len, r, iov[1], 256);
+    if (dhash_hash_many(opts, objects, 3) != 0) return -1;
+    for (int k = 1; k < 3; k++) {
+        if (objects[k].digest_len != objects[0].digest_len
+            || memcmp(objects[k].digest, objects[0].digest, objects[0].digest_len) != 0) {
+            return -1;
+        }
+    }
+    memcpy(out, objects[0].digest, objects[0].digest_len);
+    *out_len = objects[0].digest_len;
+    return 0;
+}
+
+// dhash_update_fd over the input file with an arbitrary, unaligned buffer size
+static int digest_fd(const dhash_opts* opts, rng* r, unsigned char* out, size_t* out_len) {
+    size_t size = rng_range(r, 1, 70000);
+    uint8_t* buffer = malloc(size);
+    dhash_ctx* ctx = dhash_ctx_new(opts);
+    int fd = open(input_path, O_RDONLY);
+    int rc = (!buffer || !ctx || fd < 0) ? -1 : 0;
+    if (rc == 0) rc = dhash_update_fd(ctx, fd, buffer, size, NULL);
+    if (rc == 0) rc = dhash_final(ctx, out, out_len);
+    if (fd >= 0) close(fd);
+    dhash_ctx_free(ctx);
+    free(buffer);
+    return rc;
+}
+
+// The sketch rides on the digest's stream: it must not change the digest, and
+// random splits and either tiling must give the same sketch as dhash_file
+static void check_sketch(const uint8_t* data, size_t len, const dhash_opts* opts, rng* r, const char* want,
+                         const char* params) {
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t dlen = 0;
+    dhash_sketch whole, split;
+    expect("dhash_file_sketch", want, digest, dlen, dhash_file_sketch(input_path, opts, digest, &dlen, &whole), params);
+
+    dhash_opts o = *opts;
+    o.sketch = 1;
+    o.fused = (int)(rng_next(r) & 1);
+    dhash_ctx* ctx = dhash_ctx_new(&o);
+    if (!ctx) fail("dhash_ctx_new sketch", params);
+    for (size_t pos = 0; pos < len;) {
+        size_t n = rng_range(r, 1, len - pos < 4096 ? len - pos : 4096);
+        if (dhash_update(ctx, data + pos, n) != 0) fail("dhash_update sketch", params);
+        pos += n;
+    }
+    int rc = dhash_final(ctx, digest, &dlen);
+    if (rc == 0) rc = dhash_ctx_sketch(ctx, &split);
+    dhash_ctx_free(ctx);
+    expect("dhash_update splits sketch", want, digest, dlen, rc, params);
+    if (memcmp(&whole, &split, sizeof(whole)) != 0) fail("dhash_ctx_sketch differs from dhash_file_sketch", params);
+}
+
+// --algo rc1-rc3 on the file, split and fragment paths: the rc3 digest whatever
+// chunk_size is, printed with its "rcN:" prefix
+static void check_plain(const uint8_t* data, size_t len, const dhash_opts* opts, rng* r, const char* params) {
+    dhash_opts plain = *opts;
+    plain.algo = (int)rng_range(r, 1, 3);
+    char want[2 * DHASH_MAX_DIGEST + 1];
+    reference_plain_digest(data, len, plain.bits, want);
+
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t dlen = 0;
+    expect("dhash_file rc1-rc3", want, digest, dlen, dhash_file(input_path, &plain, digest, &dlen), params);
+    plain.chunk_size = rng_range(r, 1, FUZZ_MAX_CHUNK);
+    plain.fused = (int)(rng_next(r) & 1);
+    expect("dhash_update splits rc1-rc3", want, digest, dlen, digest_splits(data, len, &plain, r, digest, &dlen),
+           params);
+    struct iovec iov[64];
+    int iovcnt = fragment(data, len, r, iov, 64);
+    expect("dhash_hash_iov rc1-rc3", want, digest, dlen, dhash_hash_iov(&plain, iov, iovcnt, digest, &dlen), params);
+
+    char formatted[DHASH_FORMAT_MAX], prefix[8];
+    dhash_format(&plain, digest, dlen, formatted);
+    snprintf(prefix, sizeof(prefix), "rc%d:", plain.algo);
+    if (strncmp(formatted, prefix, strlen(prefix)) != 0 || strcmp(formatted + strlen(prefix), want) != 0) {
+        fail("dhash_format rcN: prefix", params);
+    }
+}
+
+// The parallel transform: large runs with several workers, for every algo
+static void check_parallel(const uint8_t* data, size_t len, const dhash_opts* opts, rng* r, const char* want,
+                           const char* params) {
+    dhash_opts par = *opts;
+    par.max_workers = (int)rng_range(r, 2, 6);
+    par.block_size = 1 << 20;
+    par.algo = (int)rng_range(r, 1, 5);
+    char plain_want[2 * DHASH_MAX_DIGEST + 1];
+    if (!dhash_algo_neighbours(par.algo)) {
+        reference_plain_digest(data, len, par.bits, plain_want);
+        want = plain_want;  // rc4 digests as rc5 does
+    }
+
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t dlen = 0;
+    expect("dhash_update runs parallel", want, digest, dlen, digest_runs(data, len, &par, r, digest, &dlen), params);
+    expect("dhash_file parallel", want, digest, dlen, dhash_file(input_path, &par, digest, &dlen), params);
+}
+
+static void check_case(const uint8_t* data, size_t len, rng* r) {
+    dhash_opts opts;
+    dhash_opts_init(&opts);
+    opts.bits = fuzz_bits[rng_next(r) % 4];
+    // Small chunks stress the framing; rc5 keeps a chunk-sized VLA on its stack
+    opts.chunk_size = (rng_next(r) & 1) ? rng_range(r, 1, 64) : rng_range(r, 1, FUZZ_MAX_CHUNK);
+    opts.max_workers = (int)rng_range(r, 1, 6);
+    opts.block_size = (rng_next(r) & 1) ? rng_range(r, 1, 4096) : rng_range(r, 1, 1 << 20);
+
+    char params[160];
+    snprintf(params, sizeof(params), "len=%zu bits=%d chunk=%zu workers=%d block=%zu",
+             len, opts.bits, opts.chunk_size, opts.max_workers, opts.block_size);
+
+    // Table transform against process_byte on the input's own neighbourhoods
+    for (size_t i = 0; i < len; i++) {
+        uint8_t prev = (uint8_t)rng_next(r), next = i + 1 < len ? data[i + 1] : 0, got;
+        dhash_transform(&data[i], 1, prev, next, &got);
+        if (got != reference_byte(data[i], prev, next)) fail("dhash_transform", params);
+    }
+
+    write_input(data, len);
+    char want[2 * DHASH_MAX_DIGEST + 2];
+    reference_digest(opts.bits, (int)opts.chunk_size, (int)rng_range(r, 1, 4), want, sizeof(want));
+
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t dlen = 0;
+    expect("dhash_file", want, digest, dlen, dhash_file(input_path, &opts, digest, &dlen), params);
+
+    dhash_opts io = opts;
+    io.direct_io = 1;
+    io.huge_pages = 1;
+    expect("dhash_file O_DIRECT/huge pages", want, digest, dlen, dhash_file(input_path, &io, digest, &dlen), params);
+    dhash_opts fused = opts;
+    fused.fused = 1;
+    expect("dhash_file fused", want, digest, dlen, dhash_file(input_path, &fused, digest, &dlen), params);
+    expect("dhash_update splits fused", want, digest, dlen, digest_splits(data, len, &fused, r, digest, &dlen), params);
+    expect("dhash_numa_file", want, digest, dlen, dhash_numa_file(input_path, &opts, digest, &dlen), params);
+    expect("dhash_update splits", want, digest, dlen, digest_splits(data, len, &opts, r, digest, &dlen), params);
+    expect("dhash_transform_frames", want, digest, dlen, digest_frames(data, len, &opts, r, digest, &dlen), params);
+    struct iovec iov[256];
+    int iovcnt = fragment(data, len, r, iov, 256);
+    expect("dhash_hash_iov", want, digest, dlen, dhash_hash_iov(&opts, iov, iovcnt, digest, &dlen), params);
+    expect("dhash_hash_many", want, digest, dlen, digest_many(data, len, &opts, r, digest, &dlen), params);
+    expect("dhash_update_fd", want, digest, dlen, digest_fd(&opts, r, digest, &dlen), params);
+    check_sketch(data, len, &opts, r, want, params);
+    check_plain(data, len, &opts, r, params);
+    if (len >= FUZZ_PARALLEL_MIN) check_parallel(data, len, &opts, r, want, params);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    fuzz_init();
+    if (size > FUZZ_MAX_INPUT) return 0;
+    // The parameters come from the input so every finding replays exactly
+    rng r = { 0x6468617368667a7aULL };  // "dhashfzz"
+    for (size_t i = 0; i < size && i < 8; i++) r.s = r.s * 131 + data[i];
+    check_case(data, size, &r);
+    return 0;
+}
+
+#ifndef DHASH_FUZZ_LIBFUZZER
+// Every (byte, prev, next) triple, once
+static void check_all_bytes(void) {
+    for (int b = 0; b < 256; b++) {
+        for (int p = 0; p < 256; p++) {
+            for (int n = 0; n < 256; n++) {
+                uint8_t in = (uint8_t)b, got;
+                dhash_transform(&in, 1, (uint8_t)p, (uint8_t)n, &got);
+                if (got != reference_byte(in, (uint8_t)p, (uint8_t)n)) {
+                    fprintf(stderr, "dhash_fuzz: byte %d prev %d next %d diverges\n", b, p, n);
+                    abort();
+                }
+            }
+        }
+        // rc1-rc3 ignore the neighbours and the framing
+        dhash_opts plain;
+        dhash_opts_init(&plain);
+        plain.algo = 3;
+        uint8_t in = (uint8_t)b, got;
+        dhash_transform_run(&plain, &in, 1, (uint64_t)b * 7, (uint8_t)~b, &got);
+        if (got != reference_plain_byte(in)) {
+            fprintf(stderr, "dhash_fuzz: rc1-rc3 byte %d diverges\n", b);
+            abort();
+        }
+    }
+}
+
+static int replay_file(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    uint8_t* data = malloc(FUZZ_MAX_INPUT);
+    size_t n = data ? fread(data, 1, FUZZ_MAX_INPUT, f) : 0;
+    fclose(f);
+    LLVMFuzzerTestOneInput(data, n);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = 200;
+    uint64_t seed = (uint64_t)time(NULL);
+    int replayed = 0, rc = 0;
+
+    fuzz_init();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else {
+            // AFL and crash reproduction: each argument is one input
+            rc |= replay_file(argv[i]);
+            replayed = 1;
+        }
+    }
+
+    if (!replayed) {
+        printf("dhash_fuzz: seed %llu, %ld iterations\n", (unsigned long long)seed, iterations);
+        check_all_bytes();
+        rng r = { seed };
+        uint8_t* data = malloc(FUZZ_MAX_INPUT);
+        for (long it = 0; it < iterations; it++) {
+            // Mostly short inputs, sometimes long enough for the parallel paths,
+            // which every 16th iteration is sure to reach
+            size_t len = (it % 16 == 15) ? rng_range(&r, FUZZ_PARALLEL_MIN, FUZZ_MAX_INPUT)
+                       : (rng_next(&r) % 8) ? rng_range(&r, 0, 5000) : rng_range(&r, 0, FUZZ_MAX_INPUT);
+            int alphabet = (rng_next(&r) & 1) ? 256 : (int)rng_range(&r, 1, 4);
+            for (size_t i = 0; i < len; i++) data[i] = (uint8_t)(rng_next(&r) % alphabet);
+            check_case(data, len, &r);
+        }
+        free(data);
+        printf("dhash_fuzz: all paths match rc5 (and rc3 for --algo rc1-rc3)\n");
+    }
+
+    return rc;
+}
+#endif
@@ -0,0 +1,113 @@
+// dhash.hpp against the C library: dhash::engine, fed in random splits, and
+// dhash::hash must give dhash_file's digest for rc3 and rc5 at 256 and 2048
+// bits, over lengths and chunk sizes that land on and around frame edges.
+
+#include "dhash.h"
+#include "dhash.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+std::uint64_t rng_state = 0x6468617368687070ULL;  // "dhashhpp"
+
+std::uint64_t rng_next() {
+    // splitmix64
+    std::uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+char input_path[4096];
+int failures = 0;
+
+void write_input(const std::vector<std::uint8_t>& data) {
+    FILE* f = std::fopen(input_path, "wb");
+    if (!f || std::fwrite(data.data(), 1, data.size(), f) != data.size() || std::fclose(f) != 0) {
+        std::perror(input_path);
+        std::exit(1);
+    }
+}
+
+std::string c_digest(int bits, int algo, std::size_t chunk) {
+    dhash_opts opts;
+    dhash_opts_init(&opts);
+    opts.bits = bits;
+    opts.algo = algo;
+    opts.chunk_size = chunk;
+    unsigned char digest[DHASH_MAX_DIGEST];
+    char hex[2 * DHASH_MAX_DIGEST + 1];
+    std::size_t len = 0;
+    if (dhash_file(input_path, &opts, digest, &len) != 0) return "dhash_file failed";
+    dhash_hex(digest, len, hex);
+    return hex;
+}
+
+template <class Digest, class Variant>
+void check(const char* name, int bits, int algo, const std::vector<std::uint8_t>& data, std::size_t chunk) {
+    std::string want = c_digest(bits, algo, chunk);
+
+    dhash::engine<Digest, Variant> e(chunk);
+    for (std::size_t pos = 0; pos < data.size();) {
+        std::size_t left = data.size() - pos;
+        std::size_t n = (rng_next() & 1) ? rng_next() % 17 : rng_next() % (left + 1);
+        if (n > left) n = left;
+        e.update(data.data() + pos, n);
+        pos += n;
+    }
+    std::string split = dhash::hex(e.final());
+    std::string whole = dhash::hex(dhash::hash<Digest, Variant>(data.data(), data.size(), chunk));
+
+    if (split != want || whole != want) {
+        std::fprintf(stderr, "dhash_hpp_test: %s len=%zu chunk=%zu\n  dhash_file: %s\n  split:      %s\n"
+                             "  one-shot:   %s\n",
+                     name, data.size(), chunk, want.c_str(), split.c_str(), whole.c_str());
+        failures++;
+    }
+}
+
+}  // namespace
+
+int main() {
+    const char* tmpdir = std::getenv("TMPDIR");
+    if (!tmpdir || !*tmpdir) tmpdir = "/tmp";
+    std::snprintf(input_path, sizeof(input_path), "%s/dhash-hpp-XXXXXX", tmpdir);
+    int fd = mkstemp(input_path);
+    if (fd < 0) {
+        std::perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    dhash_init();
+
+    const std::size_t chunks[] = { 1, 7, 512, 4096 };
+    const std::size_t lengths[] = { 0, 1, 2, 511, 512, 513, 4097, 70000, 300001 };
+    int cases = 0;
+    for (std::size_t len : lengths) {
+        std::vector<std::uint8_t> data(len);
+        int alphabet = (rng_next() & 1) ? 256 : 3;
+        for (auto& b : data) b = static_cast<std::uint8_t>(rng_next() % alphabet);
+        write_input(data);
+        for (std::size_t chunk : chunks) {
+            check<dhash::sha256, dhash::rc5>("rc5 256", 256, 5, data, chunk);
+            check<dhash::shake256<2048>, dhash::rc5>("rc5 2048", 2048, 5, data, chunk);
+            check<dhash::sha256, dhash::rc3>("rc3 256", 256, 3, data, chunk);
+            check<dhash::shake256<2048>, dhash::rc3>("rc3 2048", 2048, 3, data, chunk);
+            cases += 4;
+        }
+    }
+    unlink(input_path);
+
+    if (failures) return 1;
+    std::printf("dhash_hpp_test: %d cases match dhash_file\n", cases);
+    return 0;
+}
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include "dhash.h"
+#include "dhash_throttle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE (2u << 20)
+
+size_t dhash_io_block_size(const dhash_opts* opts) {
+    size_t size = opts->block_size;
+    if (opts->direct_io) {
+        // O_DIRECT needs the length, offset and address aligned to the device block
+        size = (size + DHASH_IO_ALIGN - 1) / DHASH_IO_ALIGN * DHASH_IO_ALIGN;
+    }
+    return size;
+}
+
+int dhash_buffer_alloc(dhash_buffer* buf, size_t size, int huge_pages) {
+    memset(buf, 0, sizeof(*buf));
+    if (size == 0) size = DHASH_IO_ALIGN;
+
+    if (huge_pages && size >= HUGE_PAGE) {
+        size_t rounded = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        // Reserved hugetlbfs pages first, then transparent huge pages
+        void* p = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            p = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED) madvise(p, rounded, MADV_HUGEPAGE);
+        }
+        if (p != MAP_FAILED) {
+            buf->data = p;
+            buf->size = size;
+            buf->mapped = rounded;
+            return 0;
+        }
+    }
+
+    void* p = NULL;
+    if (posix_memalign(&p, DHASH_IO_ALIGN, size) != 0) {
+        fprintf(stderr, "Failed to allocate %zu byte buffer\n", size);
+        return -1;
+    }
+    buf->data = p;
+    buf->size = size;
+    return 0;
+}
+
+void dhash_buffer_free(dhash_buffer* buf) {
+    if (!buf->data) return;
+    if (buf->mapped) munmap(buf->data, buf->mapped);
+    else free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+int dhash_open_input(const char* path, const dhash_opts* opts) {
+    int flags = O_RDONLY | O_CLOEXEC;
+    if (opts->direct_io) {
+        int fd = open(path, flags | O_DIRECT);
+        if (fd >= 0) return fd;
+        // tmpfs and some network filesystems refuse O_DIRECT; read through the cache
+        if (errno != EINVAL) return -1;
+    }
+    int fd = open(path, flags);
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (fd >= 0) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return fd;
+}
+
+struct dhash_reader {
+    dhash_fill_fn fill;
+    void* fill_arg;
+    int fd;
+    int direct;
+    dhash_throttle* throttle;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+    int nslots;
+    dhash_buffer* slots;
+    ssize_t* lens;
+    int head, count;   // oldest filled slot, slots filled or held by the consumer
+    int holding;       // the consumer still owns slots[head]
+    int stop;
+};
+
+// Fill a slot completely unless the stream ends first
+static ssize_t fill_from_fd(void* arg, uint8_t* data, size_t size) {
+    dhash_reader* r = arg;
+    size_t have = 0;
+    while (have < size) {
+        ssize_t n = read(r->fd, data + have, size - have);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Failed to read input");
+            return -1;
+        }
+        if (n == 0) break;
+        have += (size_t)n;
+        dhash_throttle_read(r->throttle, (size_t)n);
+        // A short O_DIRECT read is the end of the file
+        if (r->direct && (size_t)n % DHASH_IO_ALIGN != 0) break;
+    }
+    return (ssize_t)have;
+}
+
+static void* reader_main(void* arg) {
+    dhash_reader* r = arg;
+    int tail = 0;
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+        while (r->count == r->nslots && !r->stop) pthread_cond_wait(&r->drained, &r->lock);
+        int stop = r->stop;
+        pthread_mutex_unlock(&r->lock);
+        if (stop) return NULL;
+
+        ssize_t n = r->fill(r->fill_arg, r->slots[tail].data, r->slots[tail].size);
+
+        pthread_mutex_lock(&r->lock);
+        r->lens[tail] = n;
+        r->count++;
+        pthread_cond_signal(&r->filled);
+        pthread_mutex_unlock(&r->lock);
+        if (n <= 0) return NULL;
+        tail = (tail + 1) % r->nslots;
+    }
+}
+
+dhash_reader* dhash_reader_start(int fd, const dhash_opts* opts, int slots) {
+    return dhash_reader_start_fn(NULL, NULL, fd, opts, slots);
+}
+
+dhash_reader* dhash_reader_start_fn(dhash_fill_fn fill, void* arg, int fd, const dhash_opts* opts, int slots) {
+    dhash_reader* r = calloc(1, sizeof(*r));
+    if (!r) {
+        perror("Failed to allocate reader");
+        return NULL;
+    }
+    int fl = fd >= 0 ? fcntl(fd, F_GETFL) : -1;
+    r->fill = fill ? fill : fill_from_fd;
+    r->fill_arg = fill ? arg : r;
+    r->fd = fd;
+    r->direct = fl >= 0 && (fl & O_DIRECT);
+    r->throttle = opts->throttle;
+    r->nslots = slots < 2 ? 2 : slots;
+    r->slots = calloc(r->nslots, sizeof(*r->slots));
+    r->lens = calloc(r->nslots, sizeof(*r->lens));
+    int ok = r->slots && r->lens;
+    for (int i = 0; ok && i < r->nslots; i++) {
+        ok = dhash_buffer_alloc(&r->slots[i], dhash_io_block_size(opts), opts->huge_pages) == 0;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->filled, NULL);
+    pthread_cond_init(&r->drained, NULL);
+    if (!ok || pthread_create(&r->thread, NULL, reader_main, r) != 0) {
+        if (ok) perror("Failed to start reader thread");
+        r->stop = 1;
+        dhash_reader_stop(r);
+        return NULL;
+    }
+    return r;
+}
+
+ssize_t dhash_reader_next(dhash_reader* r, const uint8_t** data) {
+    pthread_mutex_lock(&r->lock);
+    if (r->holding) {
+        r->holding = 0;
+        r->head = (r->head + 1) % r->nslots;
+        r->count--;
+        pthread_cond_signal(&r->drained);
+    }
+    while (r->count == 0) pthread_cond_wait(&r->filled, &r->lock);
+    ssize_t n = r->lens[r->head];
+    if (n > 0) {
+        r->holding = 1;
+        *data = r->slots[r->head].data;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return n;
+}
+
+void dhash_reader_stop(dhash_reader* r) {
+    if (!r) return;
+    pthread_mutex_lock(&r->lock);
+    int running = !r->stop;
+    r->stop = 1;
+    pthread_cond_signal(&r->drained);
+    pthread_mutex_unlock(&r->lock);
+    if (running) pthread_join(r->thread, NULL);
+
+    for (int i = 0; r->slots && i < r->nslots; i++) dhash_buffer_free(&r->slots[i]);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->filled);
+    pthread_cond_destroy(&r->drained);
+    free(r->slots);
+    free(r->lens);
+    free(r);
+}
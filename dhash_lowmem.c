@@ -0,0 +1,127 @@
+#include "dhash_lowmem.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Limits at or above this are "no limit" (v1 reports LONG_MAX rounded to a page)
+#define UNLIMITED (1ull << 62)
+
+// "max" or a byte count; returns -1 for no limit or an unreadable file
+static int read_limit(const char* path, uint64_t* limit) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    char buf[64];
+    int rc = -1;
+    if (fgets(buf, sizeof(buf), f) && strncmp(buf, "max", 3) != 0) {
+        char* end = NULL;
+        unsigned long long v = strtoull(buf, &end, 10);
+        if (end != buf && v < UNLIMITED) {
+            *limit = v;
+            rc = 0;
+        }
+    }
+    fclose(f);
+    return rc;
+}
+
+// The cgroup path may be relative to an ancestor when the namespace root is
+// mounted, so every ancestor is tried and the smallest limit wins
+static int tightest_limit(const char* mount, const char* cgroup, const char* file, uint64_t* limit) {
+    char path[4200], dir[4096];
+    snprintf(dir, sizeof(dir), "%s", cgroup);
+    int found = 0;
+    for (;;) {
+        uint64_t v;
+        snprintf(path, sizeof(path), "%s%s/%s", mount, strcmp(dir, "/") == 0 ? "" : dir, file);
+        if (read_limit(path, &v) == 0 && (!found || v < *limit)) {
+            *limit = v;
+            found = 1;
+        }
+        char* slash = strrchr(dir, '/');
+        if (!slash || strcmp(dir, "/") == 0) break;
+        if (slash == dir) slash[1] = '\0';
+        else *slash = '\0';
+    }
+    return found ? 0 : -1;
+}
+
+int dhash_cgroup_memory_max(uint64_t* limit) {
+    FILE* f = fopen("/proc/self/cgroup", "r");
+    if (!f) return -1;
+    char line[4096];
+    int found = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        // "0::/path" for v2; "N:memory:/path" (possibly among other controllers) for v1
+        char* ctrl = strchr(line, ':');
+        char* path = ctrl ? strchr(ctrl + 1, ':') : NULL;
+        if (!path) continue;
+        *path++ = '\0';
+        ctrl++;
+        uint64_t v;
+        int ok = -1;
+        if (*ctrl == '\0') {
+            // Pure v2 at /sys/fs/cgroup, or the hybrid layout's unified mount
+            ok = tightest_limit("/sys/fs/cgroup", path, "memory.max", &v);
+            if (ok != 0) ok = tightest_limit("/sys/fs/cgroup/unified", path, "memory.max", &v);
+        } else {
+            for (char* c = strtok(ctrl, ","); c; c = strtok(NULL, ",")) {
+                if (strcmp(c, "memory") == 0) {
+                    ok = tightest_limit("/sys/fs/cgroup/memory", path, "memory.limit_in_bytes", &v);
+                    break;
+                }
+            }
+        }
+        if (ok == 0 && (!found || v < *limit)) {
+            *limit = v;
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found ? 0 : -1;
+}
+
+static int mem_available(uint64_t* bytes) {
+    FILE* f = fopen("/proc/meminfo", "r");
+    if (!f) return -1;
+    char line[256];
+    int rc = -1;
+    unsigned long long kb;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) {
+            *bytes = kb << 10;
+            rc = 0;
+            break;
+        }
+    }
+    fclose(f);
+    return rc;
+}
+
+size_t dhash_lowmem_budget(size_t explicit_budget) {
+    if (explicit_budget) return explicit_budget;
+    uint64_t limit;
+    if (dhash_cgroup_memory_max(&limit) != 0 && mem_available(&limit) != 0) {
+        limit = 64ull << 20;  // nothing to go on: assume the smallest appliance
+    }
+    return (size_t)(limit / DHASH_LOWMEM_SHARE);
+}
+
+void dhash_lowmem_fit(dhash_opts* opts, size_t budget) {
+    // The fused loop keeps one tile per context instead of a 1 MiB staging block
+    opts->fused = 1;
+    opts->huge_pages = 0;  // 2 MiB granularity
+    opts->numa = 0;        // three segments per worker
+
+    size_t ctx = dhash_ctx_memory(opts);
+    size_t room = budget > ctx ? budget - ctx : 0;
+    size_t block = room / DHASH_LOWMEM_SLOTS / DHASH_IO_ALIGN * DHASH_IO_ALIGN;
+    if (block < DHASH_LOWMEM_MIN_BLOCK) block = DHASH_LOWMEM_MIN_BLOCK;
+    if (block > DHASH_DEFAULT_BLOCK) block = DHASH_DEFAULT_BLOCK;
+    if (opts->block_size > block) opts->block_size = block;
+
+    size_t per_worker = ctx + dhash_io_block_size(opts);
+    size_t workers = budget / per_worker;
+    if (workers < 1) workers = 1;
+    if ((size_t)opts->max_workers > workers) opts->max_workers = (int)workers;
+}
@@ -0,0 +1,26 @@
+#ifndef DHASH_LOWMEM_H
+#define DHASH_LOWMEM_H
+
+#include "dhash.h"
+
+// Low-memory mode for small appliances: every buffer is sized from one hard
+// budget, so memory use is constant whatever the input size.
+
+#define DHASH_LOWMEM_SHARE 4   // default budget: this fraction of the memory limit
+#define DHASH_LOWMEM_SLOTS 5   // blocks in flight: a read-ahead ring of 4 plus the digest's
+#define DHASH_LOWMEM_MIN_BLOCK (64 << 10)
+
+// Tightest memory limit of this process's cgroup and its ancestors: cgroup v2
+// memory.max, else v1 memory.limit_in_bytes. Returns -1 when there is none.
+int dhash_cgroup_memory_max(uint64_t* limit);
+
+// explicit_budget if non-zero, else 1/DHASH_LOWMEM_SHARE of the cgroup limit,
+// else of MemAvailable
+size_t dhash_lowmem_budget(size_t explicit_budget);
+
+// Fit opts to budget: fused loop (one 8 KiB tile per context), block size so
+// DHASH_LOWMEM_SLOTS blocks fit, workers so each has a block and a context, no
+// huge pages or NUMA segment pipeline. Digests are unchanged.
+void dhash_lowmem_fit(dhash_opts* opts, size_t budget);
+
+#endif
@@ -0,0 +1,534 @@
+#include "dhash_numa.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "dhash.h"
+#include "dhash_lowmem.h"
+#include "dhash_modes.h"
+#include "dhash_sketch.h"
+#include "dhash_throttle.h"
+#include "dhash_tune.h"
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s <file|-> [bits=256|512|1024|2048] [chunk_size=512] [max_workers=4] [--time]\n"
+            "       %s --diff <file_a> <file_b> [--all] [options]\n"
+            "       %s --cdc <min/avg/max> <file> [options]\n"
+            "       %s --tar <archive.tar|-> [options]\n"
+            "       %s --daemon [--socket PATH] [options]\n"
+            "       %s --batch [--files-from LIST] [options] [file...]\n"
+            "       %s --watch <dir> [--debounce MS] [options]\n"
+            "       %s --tree <file> [--range-size N] [--tree-workers N] [--worker-cmd CMD]... [options]\n"
+            "       %s --compare <file|sketch> <file|sketch> [options]\n"
+            "       %s --similar <LIST|-> [--threshold PCT] [--workers N]\n"
+            "       %s --autotune [--bits N] [--chunk-size N] [--direct]\n"
+            "Options:\n"
+            "  --bits N          digest size: 256, 512 (SHA-2), 1024, 2048 (SHAKE256)\n"
+            "  --chunk-size N    rc5 chunk framing (changes the digest, default 512)\n"
+            "  --algo rcN        transform of rc1..rc5 (default rc5); other than rc5, digests\n"
+            "                    are printed as \"rcN:<hex>\"\n"
+            "  --workers N       OpenMP threads (default 4)\n"
+            "  --block-size N    read size in bytes (does not change the digest)\n"
+            "  --direct          read with O_DIRECT, bypassing the page cache\n"
+            "  --huge-pages      back read buffers with huge pages (hugetlbfs, else THP)\n"
+            "  --numa            pin workers per NUMA node with node-local buffers\n"
+            "  --low-memory      size blocks, workers and contexts to a fixed budget (--mem-budget,\n"
+            "                    else 1/4 of the cgroup memory limit or of available memory);\n"
+            "                    not with --diff, --cdc or --decompress\n"
+            "  --fused           transform and digest in L1-sized tiles on one thread\n"
+            "  --numa-report     print local/remote page allocation counts to stderr\n"
+            "  --time            print elapsed time\n"
+            "  --diff A B        compare two files and print both digests\n"
+            "  --all             with --diff, list every divergent region\n"
+            "  --cdc MIN/AVG/MAX content-defined chunks: print \"offset length digest\" per chunk\n"
+            "  --copy-to DEST    copy the file (or - for stdin) to DEST while hashing it\n"
+            "  --fsync           with --copy-to, sync DEST and its directory before exiting\n"
+            "  --tar             digest every member of a tar stream, then the whole archive\n"
+            "  --decompress      hash the content of gzip (and zstd) input; with a file or --tar\n"
+            "  --daemon          serve requests on a Unix socket with max_workers warm workers\n"
+            "  --socket PATH     daemon socket (default " DHASH_DEFAULT_SOCKET ")\n"
+            "  --batch           hash every file argument, printing \"digest  path\" lines\n"
+            "  --files-from LIST with --batch, read paths one per line from LIST (- for stdin)\n"
+            "  --order ORDER     with --batch, hash largest (default), smallest or input first;\n"
+            "                    files mostly in page cache go ahead, output stays in input order\n"
+            "  --mem-budget N    with --batch, admit files only while their buffers fit in N bytes;\n"
+            "                    with --low-memory, the budget for all buffers\n"
+            "  --split-size N    with --batch, hash files of N bytes or more with every worker\n"
+            "                    (default 1G, 0 never)\n"
+            "  --sketch          with a file or --batch, also print a similarity sketch (\"dhs1:...\")\n"
+            "                    of the transformed stream, built in the same pass\n"
+            "  --compare A B     print the similarity (0-100) of two files or sketches\n"
+            "  --similar LIST    all-vs-all over --batch --sketch output, printing\n"
+            "                    \"score  path_a  path_b\" for similar pairs\n"
+            "  --threshold PCT   with --similar, lowest score printed (default 50)\n"
+            "  --watch DIR       hash DIR's files, then report added/modified/removed files as\n"
+            "                    their digests change (inotify, re-hashed on max_workers threads)\n"
+            "  --debounce MS     with --watch, wait until a file is quiet this long (default 100)\n"
+            "  --tree            tree-mode root over chunk-aligned ranges (not the stream digest)\n"
+            "  --range-size N    with --tree, bytes per range, a multiple of the chunk size (default 64M)\n"
+            "  --leaves          with --tree, print \"offset length digest\" per range first\n"
+            "  --tree-workers N  with --tree, hash ranges in N worker processes\n"
+            "  --worker-cmd CMD  with --tree, add a worker run as \"CMD --tree-worker FILE ...\"\n"
+            "                    (e.g. \"ssh node1 dhash\"); repeat for more workers\n"
+            "  --retries N       with --tree, attempts per range and restarts per worker (default 3)\n"
+            "  --range-timeout S with --tree, requeue a worker's ranges after S seconds without a reply\n"
+            "                    (default 600, 0 for none)\n"
+            "  --metrics FILE    write OpenMetrics text for node_exporter's textfile collector\n"
+            "  --metrics-interval SECONDS  how often to rewrite the metrics file (default 15)\n"
+            "  --background      idle I/O class, SCHED_IDLE, drop cache we populate, back off on PSI\n"
+            "  --read-limit RATE cap read bandwidth in bytes/s (K/M/G suffixes)\n"
+            "  --transform-limit RATE  cap transformed bytes/s\n"
+            "  --psi-limit PCT   with --background, pause while cpu/io pressure avg10 exceeds PCT\n"
+            "                    (default 10, 0 disables)\n"
+            "  --autotune        calibrate block size, workers and variant per input size and\n"
+            "                    save them as this host's profile, used when not given here\n"
+            "  --profile FILE    profile location (default ~/.config/dhash/profile)\n"
+            "  --no-profile      ignore the saved profile\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog);
+}
+
+// Parse a positive size, accepting K/M/G suffixes
+static int parse_size(const char* s, size_t* out) {
+    char* end = NULL;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s) return -1;
+    switch (*end) {
+        case 'k': case 'K': v <<= 10; end++; break;
+        case 'm': case 'M': v <<= 20; end++; break;
+        case 'g': case 'G': v <<= 30; end++; break;
+    }
+    if (*end != '\0' || v == 0) return -1;
+    *out = (size_t)v;
+    return 0;
+}
+
+// Parse "min/avg/max" chunk sizes
+static int parse_cdc(const char* s, dhash_cdc_params* cp) {
+    char buf[96];
+    size_t sizes[3];
+    if (strlen(s) >= sizeof(buf)) return -1;
+    strcpy(buf, s);
+    char* save = NULL;
+    char* tok = strtok_r(buf, "/", &save);
+    for (int k = 0; k < 3; k++) {
+        if (!tok || parse_size(tok, &sizes[k]) != 0) return -1;
+        tok = strtok_r(NULL, "/", &save);
+    }
+    if (tok) return -1;
+    return dhash_cdc_init(cp, sizes[0], sizes[1], sizes[2]);
+}
+
+static int parse_int(const char* s, int* out) {
+    char* end = NULL;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end != '\0') return -1;
+    *out = (int)v;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    dhash_opts opts;
+    dhash_opts_init(&opts);
+
+    int time_flag = 0;
+    int diff_flag = 0;
+    int all_flag = 0;
+    int cdc_flag = 0;
+    int tar_flag = 0;
+    dhash_cdc_params cdc;
+    int daemon_flag = 0;
+    const char* socket_path = NULL;
+    int batch_flag = 0;
+    const char* files_from = NULL;
+    dhash_batch_opts sched = { .order = DHASH_ORDER_LARGEST, .split_size = DHASH_BATCH_SPLIT };
+    int lowmem_flag = 0;
+    int compare_flag = 0;
+    const char* similar_list = NULL;
+    int threshold = 50;
+    const char* watch_dir = NULL;
+    double debounce = DHASH_WATCH_DEBOUNCE;
+    const char* copy_to = NULL;
+    int fsync_flag = 0;
+    int tree_flag = 0;
+    const char* tree_worker = NULL;
+    dhash_tree_opts tree = { .retries = DHASH_TREE_RETRIES, .range_timeout = DHASH_TREE_RANGE_TIMEOUT };
+    const char* metrics_path = NULL;
+    double metrics_interval = DHASH_METRICS_INTERVAL;
+    dhash_throttle_opts throttle_opts = { 0 };
+    int throttle_flag = 0;
+    int numa_report = 0;
+    int autotune_flag = 0;
+    int use_profile = 1;
+    char profile_path[4096] = "";
+    // Settings given explicitly always win over the profile
+    int block_set = 0, workers_set = 0, variant_set = 0;
+    char** positional = calloc(argc, sizeof(char*));
+    int npositional = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        int bad = 0;
+
+        if (strcmp(arg, "--time") == 0) {
+            time_flag = 1;
+        } else if (strcmp(arg, "--diff") == 0) {
+            diff_flag = 1;
+        } else if (strcmp(arg, "--all") == 0) {
+            all_flag = 1;
+        } else if (strcmp(arg, "--cdc") == 0) {
+            bad = !value || parse_cdc(value, &cdc) != 0;
+            cdc_flag = 1;
+            i++;
+        } else if (strcmp(arg, "--tar") == 0) {
+            tar_flag = 1;
+        } else if (strcmp(arg, "--decompress") == 0) {
+            opts.decompress = 1;
+        } else if (strcmp(arg, "--daemon") == 0) {
+            daemon_flag = 1;
+        } else if (strcmp(arg, "--socket") == 0) {
+            bad = !value;
+            socket_path = value;
+            i++;
+        } else if (strcmp(arg, "--batch") == 0) {
+            batch_flag = 1;
+        } else if (strcmp(arg, "--files-from") == 0) {
+            bad = !value;
+            files_from = value;
+            i++;
+        } else if (strcmp(arg, "--order") == 0) {
+            bad = !value;
+            if (!bad && strcmp(value, "largest") == 0) sched.order = DHASH_ORDER_LARGEST;
+            else if (!bad && strcmp(value, "smallest") == 0) sched.order = DHASH_ORDER_SMALLEST;
+            else if (!bad && strcmp(value, "input") == 0) sched.order = DHASH_ORDER_INPUT;
+            else bad = 1;
+            i++;
+        } else if (strcmp(arg, "--low-memory") == 0) {
+            lowmem_flag = 1;
+        } else if (strcmp(arg, "--mem-budget") == 0) {
+            bad = !value || parse_size(value, &sched.mem_budget) != 0;
+            i++;
+        } else if (strcmp(arg, "--split-size") == 0) {
+            size_t split = 0;
+            bad = !value || (strcmp(value, "0") != 0 && parse_size(value, &split) != 0);
+            sched.split_size = split;
+            i++;
+        } else if (strcmp(arg, "--sketch") == 0) {
+            opts.sketch = 1;
+        } else if (strcmp(arg, "--compare") == 0) {
+            compare_flag = 1;
+        } else if (strcmp(arg, "--similar") == 0) {
+            bad = !value;
+            similar_list = value;
+            i++;
+        } else if (strcmp(arg, "--threshold") == 0) {
+            bad = !value || parse_int(value, &threshold) != 0 || threshold < 0 || threshold > 100;
+            i++;
+        } else if (strcmp(arg, "--watch") == 0) {
+            bad = !value;
+            watch_dir = value;
+            i++;
+        } else if (strcmp(arg, "--debounce") == 0) {
+            bad = !value || (debounce = atof(value) / 1000) < 0;
+            i++;
+        } else if (strcmp(arg, "--copy-to") == 0) {
+            bad = !value;
+            copy_to = value;
+            i++;
+        } else if (strcmp(arg, "--fsync") == 0) {
+            fsync_flag = 1;
+        } else if (strcmp(arg, "--tree") == 0) {
+            tree_flag = 1;
+        } else if (strcmp(arg, "--tree-worker") == 0) {
+            bad = !value;
+            tree_worker = value;
+            i++;
+        } else if (strcmp(arg, "--range-size") == 0) {
+            size_t range = 0;
+            bad = !value || parse_size(value, &range) != 0;
+            tree.range_size = range;
+            i++;
+        } else if (strcmp(arg, "--leaves") == 0) {
+            tree.print_leaves = 1;
+        } else if (strcmp(arg, "--tree-workers") == 0) {
+            bad = !value || parse_int(value, &tree.local_workers) != 0 || tree.local_workers < 0;
+            i++;
+        } else if (strcmp(arg, "--worker-cmd") == 0) {
+            bad = !value;
+            tree.commands = realloc(tree.commands, (size_t)(tree.ncommands + 1) * sizeof(char*));
+            tree.commands[tree.ncommands++] = argv[i + 1];
+            i++;
+        } else if (strcmp(arg, "--retries") == 0) {
+            bad = !value || parse_int(value, &tree.retries) != 0 || tree.retries < 0;
+            i++;
+        } else if (strcmp(arg, "--range-timeout") == 0) {
+            bad = !value || (tree.range_timeout = atof(value)) < 0;
+            i++;
+        } else if (strcmp(arg, "--metrics") == 0) {
+            bad = !value;
+            metrics_path = value;
+            i++;
+        } else if (strcmp(arg, "--metrics-interval") == 0) {
+            bad = !value || (metrics_interval = atof(value)) <= 0;
+            i++;
+        } else if (strcmp(arg, "--background") == 0) {
+            throttle_flag = 1;
+            throttle_opts.idle_priority = 1;
+            throttle_opts.drop_cache = 1;
+            if (throttle_opts.psi_threshold == 0) throttle_opts.psi_threshold = DHASH_PSI_DEFAULT;
+        } else if (strcmp(arg, "--read-limit") == 0) {
+            size_t rate = 0;
+            bad = !value || parse_size(value, &rate) != 0;
+            throttle_opts.read_bps = (double)rate;
+            throttle_flag = 1;
+            i++;
+        } else if (strcmp(arg, "--transform-limit") == 0) {
+            size_t rate = 0;
+            bad = !value || parse_size(value, &rate) != 0;
+            throttle_opts.transform_bps = (double)rate;
+            throttle_flag = 1;
+            i++;
+        } else if (strcmp(arg, "--psi-limit") == 0) {
+            bad = !value;
+            throttle_opts.psi_threshold = value ? atof(value) : 0;
+            if (throttle_opts.psi_threshold == 0) throttle_opts.psi_threshold = -1;  // explicitly off
+            i++;
+        } else if (strcmp(arg, "--direct") == 0) {
+            opts.direct_io = 1;
+        } else if (strcmp(arg, "--huge-pages") == 0) {
+            opts.huge_pages = 1;
+        } else if (strcmp(arg, "--autotune") == 0) {
+            autotune_flag = 1;
+        } else if (strcmp(arg, "--profile") == 0) {
+            bad = !value || strlen(value) >= sizeof(profile_path);
+            if (!bad) strcpy(profile_path, value);
+            i++;
+        } else if (strcmp(arg, "--no-profile") == 0) {
+            use_profile = 0;
+        } else if (strcmp(arg, "--numa") == 0) {
+            opts.numa = 1;
+            variant_set = 1;
+        } else if (strcmp(arg, "--fused") == 0) {
+            opts.fused = 1;
+            variant_set = 1;
+        } else if (strcmp(arg, "--numa-report") == 0) {
+            numa_report = 1;
+        } else if (strcmp(arg, "--algo") == 0) {
+            bad = !value || dhash_algo_parse(value, &opts.algo) != 0;
+            i++;
+        } else if (strcmp(arg, "--bits") == 0) {
+            bad = !value || parse_int(value, &opts.bits) != 0;
+            i++;
+        } else if (strcmp(arg, "--chunk-size") == 0) {
+            bad = !value || parse_size(value, &opts.chunk_size) != 0;
+            i++;
+        } else if (strcmp(arg, "--workers") == 0) {
+            bad = !value || parse_int(value, &opts.max_workers) != 0;
+            workers_set = 1;
+            i++;
+        } else if (strcmp(arg, "--block-size") == 0) {
+            bad = !value || parse_size(value, &opts.block_size) != 0;
+            block_set = 1;
+            i++;
+        } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (strncmp(arg, "--", 2) == 0 || (arg[0] == '-' && arg[1] != '\0')) {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            bad = 1;
+        } else {
+            positional[npositional++] = argv[i];
+        }
+
+        if (bad) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (files_from && dhash_read_file_list(files_from, &positional, &npositional) != 0) {
+        return 1;
+    }
+
+    // Legacy rc5 form: <file> [bits] [chunk_size] [max_workers]
+    int nfiles = (diff_flag || compare_flag) ? 2
+               : (daemon_flag || autotune_flag || watch_dir || tree_worker || similar_list) ? 0 : 1;
+    if (batch_flag) {
+        nfiles = npositional;
+    } else if (npositional < nfiles || npositional > nfiles + 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    int bad = 0;
+    if (npositional > nfiles) bad |= parse_int(positional[nfiles], &opts.bits);
+    if (npositional > nfiles + 1) bad |= parse_size(positional[nfiles + 1], &opts.chunk_size);
+    if (npositional > nfiles + 2) {
+        bad |= parse_int(positional[nfiles + 2], &opts.max_workers);
+        workers_set = 1;
+    }
+    if (opts.decompress && (daemon_flag || batch_flag || diff_flag || cdc_flag || watch_dir || tree_flag)) {
+        fprintf(stderr, "--decompress works on a single file or with --tar\n");
+        bad = 1;
+    }
+    if (copy_to && (daemon_flag || batch_flag || diff_flag || cdc_flag || watch_dir || tree_flag || tar_flag
+                    || opts.decompress)) {
+        fprintf(stderr, "--copy-to works on a single file\n");
+        bad = 1;
+    }
+    if (opts.sketch && (daemon_flag || diff_flag || cdc_flag || watch_dir || tree_flag || tar_flag
+                        || opts.decompress || copy_to || compare_flag || similar_list)) {
+        fprintf(stderr, "--sketch works on a single file or with --batch\n");
+        bad = 1;
+    }
+    // Fixed-size buffers (4 MiB diff blocks, the CDC window, decompression
+    // batches) that the budget does not shape
+    if (lowmem_flag && (diff_flag || cdc_flag || opts.decompress)) {
+        fprintf(stderr, "--low-memory does not work with --diff, --cdc or --decompress\n");
+        bad = 1;
+    }
+    if (bad || dhash_check_opts(&opts) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    dhash_init();
+
+    // Workers take their parameters from the coordinator, never from a profile
+    if (tree_worker) {
+        return dhash_tree_worker(tree_worker, &opts);
+    }
+    // Reads sketches, not files
+    if (similar_list) {
+        return dhash_similar_run(similar_list, threshold, opts.max_workers);
+    }
+
+    if (!profile_path[0] && dhash_profile_path(profile_path, sizeof(profile_path)) != 0) {
+        use_profile = 0;
+    }
+    if (autotune_flag) {
+        if (!profile_path[0]) {
+            fprintf(stderr, "No profile location: set HOME or use --profile\n");
+            return 1;
+        }
+        return dhash_autotune_run(&opts, profile_path);
+    }
+
+    dhash_profile profile;
+    if (use_profile && dhash_profile_load(profile_path, &profile) == 0) {
+        const dhash_tune_class* t;
+        struct stat st;
+        if (batch_flag || daemon_flag || watch_dir) {
+            // Many inputs of unknown size, and workers already mean files in flight
+            t = dhash_profile_lookup(&profile, (uint64_t)(64 << 20));
+            workers_set = variant_set = 1;
+        } else {
+            t = dhash_profile_lookup(&profile, stat(positional[0], &st) == 0 ? (uint64_t)st.st_size : UINT64_MAX);
+        }
+        if (!block_set) opts.block_size = t->block_size;
+        if (!workers_set) opts.max_workers = t->workers;
+        if (!variant_set) {
+            opts.numa = (t->variant == DHASH_VARIANT_NUMA);
+            opts.fused = (t->variant == DHASH_VARIANT_FUSED);
+        }
+    }
+
+    if (lowmem_flag) {
+        // After the profile: the budget caps whatever it or the command line chose
+        sched.mem_budget = dhash_lowmem_budget(sched.mem_budget);
+        dhash_lowmem_fit(&opts, sched.mem_budget);
+    }
+
+    if (throttle_flag) {
+        if (throttle_opts.psi_threshold < 0) throttle_opts.psi_threshold = 0;
+        opts.throttle = dhash_throttle_new(&throttle_opts);
+        if (!opts.throttle) return 1;
+        // Before any worker thread exists, so they all inherit it
+        dhash_throttle_apply_priority(opts.throttle);
+    }
+
+    dhash_metrics* metrics = NULL;
+    if (metrics_path) {
+        metrics = dhash_metrics_open(metrics_path, metrics_interval, daemon_flag ? "daemon" : watch_dir ? "watch" : "batch");
+        if (!metrics) return 1;
+    }
+
+    if (daemon_flag) {
+        return dhash_daemon_run(socket_path, &opts, metrics);
+    }
+    if (watch_dir) {
+        int rc = dhash_watch_run(watch_dir, &opts, debounce, metrics);
+        dhash_metrics_close(metrics);
+        dhash_throttle_free(opts.throttle);
+        return rc;
+    }
+
+    struct timespec start, end;
+    if (time_flag) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    dhash_numa_stats numa_before;
+    if (numa_report) dhash_numa_sample(&numa_before);
+
+    int rc = 0;
+    if (batch_flag) {
+        rc = dhash_batch_run(positional, npositional, &opts, &sched, metrics);
+    } else if (diff_flag) {
+        rc = dhash_diff_files(positional[0], positional[1], &opts, all_flag);
+    } else if (compare_flag) {
+        rc = dhash_compare_run(positional[0], positional[1], &opts);
+    } else if (tree_flag) {
+        rc = dhash_tree_file(positional[0], &opts, &tree);
+    } else if (tar_flag) {
+        rc = dhash_tar_file(positional[0], &opts);
+    } else if (cdc_flag) {
+        rc = dhash_cdc_file(positional[0], &opts, &cdc);
+    } else {
+        unsigned char digest[DHASH_MAX_DIGEST];
+        char hex[DHASH_FORMAT_MAX];
+        size_t len = 0;
+        dhash_variant variant = opts.numa ? DHASH_VARIANT_NUMA
+                              : opts.fused ? DHASH_VARIANT_FUSED : DHASH_VARIANT_STREAM;
+        int hashed;
+        dhash_sketch sketch;
+        if (opts.sketch) {
+            // The streaming context carries the sketch; opts.fused still applies
+            hashed = dhash_file_sketch(positional[0], &opts, digest, &len, &sketch);
+        } else if (copy_to) {
+            hashed = dhash_copy_file(positional[0], copy_to, &opts, fsync_flag, digest, &len);
+        } else if (opts.decompress) {
+            hashed = dhash_decompress_file(positional[0], &opts, digest, &len);
+        } else {
+            hashed = dhash_file_variant(positional[0], &opts, variant, digest, &len);
+        }
+        if (hashed == 0) {
+            dhash_format(&opts, digest, len, hex);
+            if (opts.sketch) {
+                char text[DHASH_SKETCH_TEXT];
+                dhash_sketch_format(&sketch, text);
+                printf("%s %s\n", hex, text);
+            } else {
+                printf("%s\n", hex);
+            }
+        } else {
+            rc = 1;
+        }
+    }
+
+    if (numa_report) {
+        dhash_numa_stats numa_after;
+        dhash_numa_sample(&numa_after);
+        dhash_numa_report(&numa_before, &numa_after);
+    }
+    if (time_flag) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("Time elapsed: %.6f seconds\n", elapsed);
+    }
+    dhash_metrics_close(metrics);
+    dhash_throttle_free(opts.throttle);
+    return rc;
+}
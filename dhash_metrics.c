@@ -0,0 +1,237 @@
+#include "dhash_metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+// Upper bounds in seconds; the implicit last bucket is +Inf
+static const double latency_buckets[] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300
+};
+#define NBUCKETS (sizeof(latency_buckets) / sizeof(latency_buckets[0]))
+
+struct dhash_metrics {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t writer;
+    int stop;
+    char* path;
+    char* tmp_path;
+    const char* mode;
+    double interval;
+    double started;
+
+    unsigned long long buckets[NBUCKETS + 1];
+    double latency_sum;
+    unsigned long long files_ok;
+    unsigned long long files_failed;
+    unsigned long long bytes;
+    double io_seconds;
+    unsigned long long cache_hits;
+    int queued;
+    int in_flight;
+
+    // Rates are computed over the last write interval
+    double last_write;
+    unsigned long long last_bytes;
+    unsigned long long last_files;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_seconds(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+// Called with m->lock held. Writes to a temporary file and renames it so the
+// textfile collector never sees a partial file.
+static int write_metrics(dhash_metrics* m) {
+    FILE* f = fopen(m->tmp_path, "w");
+    if (!f) {
+        perror(m->tmp_path);
+        return -1;
+    }
+
+    double now = now_seconds();
+    double span = now - m->last_write;
+    unsigned long long files = m->files_ok + m->files_failed;
+    double bytes_rate = span > 0 ? (m->bytes - m->last_bytes) / span : 0;
+    double files_rate = span > 0 ? (files - m->last_files) / span : 0;
+    m->last_write = now;
+    m->last_bytes = m->bytes;
+    m->last_files = files;
+
+    fprintf(f, "# HELP dhash_file_duration_seconds Time to hash one file or request.\n");
+    fprintf(f, "# TYPE dhash_file_duration_seconds histogram\n");
+    unsigned long long cumulative = 0;
+    for (size_t i = 0; i < NBUCKETS; i++) {
+        cumulative += m->buckets[i];
+        fprintf(f, "dhash_file_duration_seconds_bucket{mode=\"%s\",le=\"%g\"} %llu\n",
+                m->mode, latency_buckets[i], cumulative);
+    }
+    cumulative += m->buckets[NBUCKETS];
+    fprintf(f, "dhash_file_duration_seconds_bucket{mode=\"%s\",le=\"+Inf\"} %llu\n", m->mode, cumulative);
+    fprintf(f, "dhash_file_duration_seconds_sum{mode=\"%s\"} %.6f\n", m->mode, m->latency_sum);
+    fprintf(f, "dhash_file_duration_seconds_count{mode=\"%s\"} %llu\n", m->mode, cumulative);
+
+    fprintf(f, "# HELP dhash_files Files or requests hashed.\n");
+    fprintf(f, "# TYPE dhash_files counter\n");
+    fprintf(f, "dhash_files_total{mode=\"%s\",result=\"ok\"} %llu\n", m->mode, m->files_ok);
+    fprintf(f, "dhash_files_total{mode=\"%s\",result=\"error\"} %llu\n", m->mode, m->files_failed);
+
+    fprintf(f, "# HELP dhash_bytes Input bytes hashed.\n");
+    fprintf(f, "# TYPE dhash_bytes counter\n");
+    fprintf(f, "dhash_bytes_total{mode=\"%s\"} %llu\n", m->mode, m->bytes);
+
+    fprintf(f, "# HELP dhash_io_wait_seconds Time spent blocked in read().\n");
+    fprintf(f, "# TYPE dhash_io_wait_seconds counter\n");
+    fprintf(f, "dhash_io_wait_seconds_total{mode=\"%s\"} %.6f\n", m->mode, m->io_seconds);
+
+    fprintf(f, "# HELP dhash_cpu_seconds User and system CPU time of the process.\n");
+    fprintf(f, "# TYPE dhash_cpu_seconds counter\n");
+    fprintf(f, "dhash_cpu_seconds_total{mode=\"%s\"} %.6f\n", m->mode, cpu_seconds());
+
+    fprintf(f, "# HELP dhash_context_cache_hits Files and requests hashed with a worker's already initialised context.\n");
+    fprintf(f, "# TYPE dhash_context_cache_hits counter\n");
+    fprintf(f, "dhash_context_cache_hits_total{mode=\"%s\"} %llu\n", m->mode, m->cache_hits);
+
+    fprintf(f, "# HELP dhash_bytes_per_second Input throughput over the last interval.\n");
+    fprintf(f, "# TYPE dhash_bytes_per_second gauge\n");
+    fprintf(f, "dhash_bytes_per_second{mode=\"%s\"} %.1f\n", m->mode, bytes_rate);
+    fprintf(f, "# HELP dhash_files_per_second Files completed per second over the last interval.\n");
+    fprintf(f, "# TYPE dhash_files_per_second gauge\n");
+    fprintf(f, "dhash_files_per_second{mode=\"%s\"} %.3f\n", m->mode, files_rate);
+
+    fprintf(f, "# HELP dhash_queue_depth Jobs waiting for a worker.\n");
+    fprintf(f, "# TYPE dhash_queue_depth gauge\n");
+    fprintf(f, "dhash_queue_depth{mode=\"%s\"} %d\n", m->mode, m->queued);
+    fprintf(f, "# HELP dhash_in_flight Jobs being hashed.\n");
+    fprintf(f, "# TYPE dhash_in_flight gauge\n");
+    fprintf(f, "dhash_in_flight{mode=\"%s\"} %d\n", m->mode, m->in_flight);
+
+    fprintf(f, "# HELP dhash_uptime_seconds Time since metrics collection started.\n");
+    fprintf(f, "# TYPE dhash_uptime_seconds gauge\n");
+    fprintf(f, "dhash_uptime_seconds{mode=\"%s\"} %.3f\n", m->mode, now - m->started);
+    fprintf(f, "# EOF\n");
+
+    if (fclose(f) != 0 || rename(m->tmp_path, m->path) != 0) {
+        perror(m->path);
+        return -1;
+    }
+    return 0;
+}
+
+static void* writer_main(void* arg) {
+    dhash_metrics* m = arg;
+    pthread_mutex_lock(&m->lock);
+    while (!m->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        double whole = (double)(long long)m->interval;
+        deadline.tv_sec += (time_t)whole;
+        deadline.tv_nsec += (long)((m->interval - whole) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int rc = 0;
+        while (!m->stop && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&m->wake, &m->lock, &deadline);
+        }
+        if (!m->stop) write_metrics(m);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+dhash_metrics* dhash_metrics_open(const char* path, double interval, const char* mode) {
+    dhash_metrics* m = calloc(1, sizeof(*m));
+    if (!m) return NULL;
+    size_t len = strlen(path);
+    m->path = strdup(path);
+    m->tmp_path = malloc(len + 5);
+    if (!m->path || !m->tmp_path) {
+        free(m->path);
+        free(m->tmp_path);
+        free(m);
+        return NULL;
+    }
+    snprintf(m->tmp_path, len + 5, "%s.tmp", path);
+    m->mode = mode;
+    m->interval = interval > 0 ? interval : DHASH_METRICS_INTERVAL;
+    m->started = m->last_write = now_seconds();
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->wake, NULL);
+
+    pthread_mutex_lock(&m->lock);
+    int rc = write_metrics(m);
+    pthread_mutex_unlock(&m->lock);
+    if (rc != 0 || pthread_create(&m->writer, NULL, writer_main, m) != 0) {
+        pthread_mutex_destroy(&m->lock);
+        pthread_cond_destroy(&m->wake);
+        free(m->path);
+        free(m->tmp_path);
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+void dhash_metrics_record(dhash_metrics* m, uint64_t bytes, double seconds, double io_seconds, int ok) {
+    if (!m) return;
+    size_t b = 0;
+    while (b < NBUCKETS && seconds > latency_buckets[b]) b++;
+    pthread_mutex_lock(&m->lock);
+    m->buckets[b]++;
+    m->latency_sum += seconds;
+    m->bytes += bytes;
+    m->io_seconds += io_seconds;
+    if (ok) m->files_ok++;
+    else m->files_failed++;
+    pthread_mutex_unlock(&m->lock);
+}
+
+void dhash_metrics_cache_hit(dhash_metrics* m) {
+    if (!m) return;
+    pthread_mutex_lock(&m->lock);
+    m->cache_hits++;
+    pthread_mutex_unlock(&m->lock);
+}
+
+void dhash_metrics_queue(dhash_metrics* m, int queued, int in_flight) {
+    if (!m) return;
+    pthread_mutex_lock(&m->lock);
+    m->queued = queued;
+    m->in_flight = in_flight;
+    pthread_mutex_unlock(&m->lock);
+}
+
+void dhash_metrics_close(dhash_metrics* m) {
+    if (!m) return;
+    pthread_mutex_lock(&m->lock);
+    m->stop = 1;
+    pthread_cond_signal(&m->wake);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->writer, NULL);
+
+    write_metrics(m);
+    pthread_mutex_destroy(&m->lock);
+    pthread_cond_destroy(&m->wake);
+    free(m->path);
+    free(m->tmp_path);
+    free(m);
+}
+
+double dhash_metrics_now(void) {
+    return now_seconds();
+}
@@ -0,0 +1,24 @@
+#ifndef DHASH_METRICS_H
+#define DHASH_METRICS_H
+
+#include <stdint.h>
+
+#define DHASH_METRICS_INTERVAL 15.0
+
+// OpenMetrics text exposition for node_exporter's textfile collector. All
+// functions accept NULL so callers can record unconditionally.
+typedef struct dhash_metrics dhash_metrics;
+
+// Start a writer that rewrites path every interval seconds; mode labels the series
+dhash_metrics* dhash_metrics_open(const char* path, double interval, const char* mode);
+// One finished file or request
+void dhash_metrics_record(dhash_metrics* m, uint64_t bytes, double seconds, double io_seconds, int ok);
+void dhash_metrics_cache_hit(dhash_metrics* m);
+void dhash_metrics_queue(dhash_metrics* m, int queued, int in_flight);
+// Write a final snapshot and stop the writer
+void dhash_metrics_close(dhash_metrics* m);
+
+// Monotonic clock in seconds, for callers timing their own work
+double dhash_metrics_now(void);
+
+#endif
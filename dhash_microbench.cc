@@ -0,0 +1,252 @@
+// Per-primitive microbenchmarks: the rc5 reference kernels from
+// directional_hash_rc5.c next to the engine's replacements, over buffer sizes
+// from one rc5 chunk to an I/O block.
+//
+//   gcc -O2 -fopenmp -c dhash.c dhash_io.c dhash_throttle.c dhash_sketch.c
+//   gcc -O2 -fopenmp -Dmain=rc5_main -c directional_hash_rc5.c
+//   g++ -O2 -std=c++17 -fopenmp dhash_microbench.cc dhash.o dhash_io.o dhash_throttle.o dhash_sketch.o
+//       directional_hash_rc5.o -o dhash_microbench -lbenchmark -lpthread -lcrypto
+//   ./dhash_microbench --benchmark_out=micro.json --benchmark_out_format=json
+//
+// Names are "<primitive>/<variant>/<bytes>", so JSON from two commits can be
+// joined on the name. A new kernel variant registers under the family of the
+// primitive it replaces (see register_all) rather than in a new harness.
+
+#include "dhash.h"
+#include "dhash.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+// The rc5 release, compiled unchanged as C with its main renamed
+extern "C" {
+extern uint8_t precomputed_coords[256][8][2];
+void precompute_weighted_patterns();
+void to_grid(uint8_t byte, char grid[3][3]);
+int generate_shift_seed(uint8_t byte, uint8_t prev, uint8_t next);
+void shuffle_grid_coords(const uint8_t original_coords[8][2], int seed, uint8_t shuffled_coords[8][2]);
+void process_byte(uint8_t byte, char* out, uint8_t prev, uint8_t next);
+}
+
+namespace {
+
+// One rc5 chunk, an L1 tile, an L2-sized run and the default I/O block
+const int64_t sizes[] = { 512, 8 << 10, 256 << 10, 1 << 20 };
+
+std::vector<uint8_t> corpus(size_t size) {
+    std::vector<uint8_t> data(size);
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    for (auto& b : data) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        b = static_cast<uint8_t>(x >> 56);
+    }
+    return data;
+}
+
+void set_bytes(benchmark::State& state, size_t per_iteration) {
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * per_iteration));
+}
+
+// ---- rc5 reference primitives -------------------------------------------
+
+void grid_rc5(benchmark::State& state) {
+    auto data = corpus(state.range(0));
+    char grid[3][3];
+    for (auto _ : state) {
+        for (uint8_t b : data) {
+            to_grid(b, grid);
+            benchmark::DoNotOptimize(grid);
+        }
+    }
+    set_bytes(state, data.size());
+}
+
+// The whole 256-entry table, as rc5 builds it once per run
+void patterns_rc5(benchmark::State& state) {
+    for (auto _ : state) {
+        precompute_weighted_patterns();
+        benchmark::DoNotOptimize(precomputed_coords);
+    }
+}
+
+void seed_rc5(benchmark::State& state) {
+    auto data = corpus(state.range(0));
+    for (auto _ : state) {
+        int acc = 0;
+        for (size_t j = 1; j + 1 < data.size(); j++) acc += generate_shift_seed(data[j], data[j - 1], data[j + 1]);
+        benchmark::DoNotOptimize(acc);
+    }
+    set_bytes(state, data.size());
+}
+
+void shuffle_rc5(benchmark::State& state) {
+    auto data = corpus(state.range(0));
+    uint8_t shuffled[8][2];
+    for (auto _ : state) {
+        for (uint8_t b : data) {
+            shuffle_grid_coords(precomputed_coords[b], b % 9, shuffled);
+            benchmark::DoNotOptimize(shuffled);
+        }
+    }
+    set_bytes(state, data.size());
+}
+
+void process_rc5(benchmark::State& state) {
+    auto data = corpus(state.range(0));
+    char out[9];
+    for (auto _ : state) {
+        for (size_t j = 0; j < data.size(); j++) {
+            process_byte(data[j], out, j ? data[j - 1] : 0, j + 1 < data.size() ? data[j + 1] : 0);
+            benchmark::DoNotOptimize(out);
+        }
+    }
+    set_bytes(state, data.size());
+}
+
+// rc5's strlen over the '0'/'1' string and bit-by-bit packing, lifted out of
+// directional_hash_file; the ASCII input is 8 characters per byte packed
+void pack_rc5(benchmark::State& state) {
+    auto data = corpus(state.range(0));
+    std::string bin;
+    for (uint8_t b : data) {
+        for (int i = 7; i >= 0; i--) bin += ((b >> i) & 1) ? '1' : '0';
+    }
+    for (auto _ : state) {
+        size_t len = strlen(bin.c_str());
+        size_t byte_len = (len + 7) / 8;
+        auto* byte_buf = static_cast<uint8_t*>(malloc(byte_len));
+        memset(byte_buf, 0, byte_len);
+        for (size_t i = 0; i < len; i++) {
+            if (bin[i] == '1') byte_buf[i / 8] |= 1 << (7 - (i % 8));
+        }
+        benchmark::DoNotOptimize(byte_buf);
+        free(byte_buf);
+    }
+    set_bytes(state, data.size());
+}
+
+// ---- engine replacements -------------------------------------------------
+
+// Table lookup: grid, seed, shuffle, process_byte and packing in one load
+void transform_table(benchmark::State& state) {
+    auto data = corpus(state.range(0));
+    std::vector<uint8_t> out(data.size());
+    for (auto _ : state) {
+        dhash_transform(data.data(), data.size(), 0, 0, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    set_bytes(state, data.size());
+}
+
+void transform_frames(benchmark::State& state) {
+    auto data = corpus(state.range(0));
+    std::vector<uint8_t> out(data.size());
+    for (auto _ : state) {
+        dhash_transform_frames(data.data(), data.size(), 0, DHASH_DEFAULT_CHUNK, 0, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    set_bytes(state, data.size());
+}
+
+void transform_hpp(benchmark::State& state) {
+    auto data = corpus(state.range(0));
+    std::vector<uint8_t> out(data.size());
+    for (auto _ : state) {
+        dhash::transform<dhash::rc5>(data.data(), data.size(), 0, 0, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    set_bytes(state, data.size());
+}
+
+// Whole transform + digest paths through the C API, one thread; "sketch" adds
+// the similarity sketch to the blocked path
+void update(benchmark::State& state, int fused, int sketch) {
+    auto data = corpus(state.range(0));
+    dhash_opts opts;
+    dhash_opts_init(&opts);
+    opts.max_workers = 1;
+    opts.fused = fused;
+    opts.sketch = sketch;
+    dhash_ctx* ctx = dhash_ctx_new(&opts);
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t len = 0;
+    for (auto _ : state) {
+        dhash_ctx_reset(ctx);
+        dhash_update(ctx, data.data(), data.size());
+        dhash_final(ctx, digest, &len);
+        benchmark::DoNotOptimize(digest);
+    }
+    dhash_ctx_free(ctx);
+    set_bytes(state, data.size());
+}
+
+void update_hpp(benchmark::State& state) {
+    auto data = corpus(state.range(0));
+    for (auto _ : state) {
+        auto digest = dhash::hash<dhash::sha256>(data.data(), data.size());
+        benchmark::DoNotOptimize(digest);
+    }
+    set_bytes(state, data.size());
+}
+
+// ---- EVP_DigestUpdate ----------------------------------------------------
+
+void digest(benchmark::State& state, const EVP_MD* md) {
+    auto data = corpus(state.range(0));
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, md, nullptr);
+    for (auto _ : state) {
+        EVP_DigestUpdate(ctx, data.data(), data.size());
+    }
+    EVP_MD_CTX_free(ctx);
+    set_bytes(state, data.size());
+}
+
+void per_size(benchmark::internal::Benchmark* b) {
+    for (int64_t size : sizes) b->Arg(size);
+}
+
+void register_all() {
+    benchmark::RegisterBenchmark("to_grid/rc5", grid_rc5)->Apply(per_size);
+    benchmark::RegisterBenchmark("precompute_weighted_patterns/rc5", patterns_rc5);
+    benchmark::RegisterBenchmark("generate_shift_seed/rc5", seed_rc5)->Apply(per_size);
+    benchmark::RegisterBenchmark("shuffle_grid_coords/rc5", shuffle_rc5)->Apply(per_size);
+    benchmark::RegisterBenchmark("pack_bits/rc5", pack_rc5)->Apply(per_size);
+
+    // process_byte through packing, the engine's unit of work
+    benchmark::RegisterBenchmark("process_byte/rc5", process_rc5)->Apply(per_size);
+    benchmark::RegisterBenchmark("process_byte/table", transform_table)->Apply(per_size);
+    benchmark::RegisterBenchmark("process_byte/frames", transform_frames)->Apply(per_size);
+    benchmark::RegisterBenchmark("process_byte/hpp", transform_hpp)->Apply(per_size);
+
+    benchmark::RegisterBenchmark("update/blocked", update, 0, 0)->Apply(per_size);
+    benchmark::RegisterBenchmark("update/fused", update, 1, 0)->Apply(per_size);
+    benchmark::RegisterBenchmark("update/sketch", update, 0, 1)->Apply(per_size);
+    benchmark::RegisterBenchmark("update/hpp", update_hpp)->Apply(per_size);
+
+    benchmark::RegisterBenchmark("EVP_DigestUpdate/sha256", digest, EVP_sha256())->Apply(per_size);
+    benchmark::RegisterBenchmark("EVP_DigestUpdate/sha512", digest, EVP_sha512())->Apply(per_size);
+    benchmark::RegisterBenchmark("EVP_DigestUpdate/shake256", digest, EVP_shake256())->Apply(per_size);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    precompute_weighted_patterns();
+    dhash_init();
+    register_all();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,123 @@
+#ifndef DHASH_MODES_H
+#define DHASH_MODES_H
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dhash.h"
+#include "dhash_metrics.h"
+
+// Command line modes built on the dhash library. Each returns the process exit code.
+
+// Compare two files in one pass, printing both digests and the divergent offsets.
+// Exit code follows cmp(1): 0 identical, 1 different, 2 trouble.
+int dhash_diff_files(const char* path_a, const char* path_b, const dhash_opts* opts, int report_all);
+
+// Split a file into content-defined chunks and print "offset length digest" per
+// chunk, followed by the whole-file digest; chunks are digested in parallel
+int dhash_cdc_file(const char* filename, const dhash_opts* opts, const dhash_cdc_params* cp);
+
+// Hash every regular member of a tar stream (path or "-" for stdin) as it is
+// read, printing "digest  member" lines and then the digest of the archive.
+// Understands ustar, GNU long names and pax path/size records.
+int dhash_tar_file(const char* filename, const dhash_opts* opts);
+
+// Reader over the decompressed content of fd: gzip (concatenated members are
+// one stream; BGZF-style sized members of a regular file decode in parallel)
+// and, when built with DHASH_HAVE_ZSTD, zstd (frames with a known size decode
+// in parallel). Other input passes through unchanged. Stop it with
+// dhash_decompress_stop(reader, handle).
+dhash_reader* dhash_decompress_start(int fd, const dhash_opts* opts, void** handle);
+void dhash_decompress_stop(dhash_reader* r, void* handle);
+// Digest of the decompressed content of filename ("-" for stdin)
+int dhash_decompress_file(const char* filename, const dhash_opts* opts, unsigned char* out, size_t* out_len);
+
+// Copy src ("-" for stdin) to dest while hashing it in the same pass and
+// return the digest of the bytes as read. Pipe input is moved with
+// tee()/splice(); otherwise each block is written from the buffer it was
+// hashed from. With fsync_dest the copy and its directory entry are synced
+// before returning. A failed copy is removed. Returns 0 or -1.
+int dhash_copy_file(const char* src, const char* dest, const dhash_opts* opts, int fsync_dest,
+                    unsigned char* out, size_t* out_len);
+
+#define DHASH_TREE_RANGE (64ull << 20)  // default range, rounded up to whole chunks
+#define DHASH_TREE_RETRIES 3
+#define DHASH_TREE_RANGE_TIMEOUT 600.0  // seconds
+
+typedef struct {
+    uint64_t range_size;  // bytes per leaf, a multiple of chunk_size; 0 = default
+    int local_workers;    // worker processes started from this binary
+    char** commands;      // one worker per shell command prefix ("ssh node1 dhash")
+    int ncommands;
+    int retries;          // attempts per range and restarts per worker
+    double range_timeout; // seconds a worker may take over one range (or its greeting); 0 = no limit
+    int print_leaves;     // print "offset length digest" per range before the root
+} dhash_tree_opts;
+
+// Tree-mode digest of a file: the file is cut into chunk-aligned ranges whose
+// digests are combined into a root. With no worker processes the ranges are
+// hashed on max_workers threads; otherwise they are handed out to workers
+// over pipes and failed ranges are retried on other workers. The root is the
+// same either way. This is not the stream digest of dhash_file.
+int dhash_tree_file(const char* filename, const dhash_opts* opts, const dhash_tree_opts* t);
+// Worker side: answer range requests for filename on stdin/stdout
+int dhash_tree_worker(const char* filename, const dhash_opts* opts);
+
+#define DHASH_WATCH_DEBOUNCE 0.1
+
+// Hash every regular file under dir, then follow inotify events and re-hash
+// changed files on max_workers threads once they have been quiet for debounce
+// seconds. Prints "added|modified|removed <digest>  <path>" whenever a file's
+// digest changes; returns on SIGINT/SIGTERM or a fatal error.
+int dhash_watch_run(const char* dir, const dhash_opts* opts, double debounce, dhash_metrics* metrics);
+
+#define DHASH_DEFAULT_SOCKET "$XDG_RUNTIME_DIR/dhash.sock, else /run/dhash-UID/dhash.sock"  // for usage text
+
+// The default socket in a directory only the user can enter: $XDG_RUNTIME_DIR,
+// or a /run/dhash-<uid> the daemon creates 0700. dhash-client links nothing
+// but libc, hence inline. Returns 0, or -1 if the path does not fit out.
+static inline int dhash_default_socket(char* out, size_t cap) {
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    int n = (dir && *dir) ? snprintf(out, cap, "%s/dhash.sock", dir)
+                          : snprintf(out, cap, "/run/dhash-%u/dhash.sock", (unsigned)geteuid());
+    return (n > 0 && (size_t)n < cap) ? 0 : -1;
+}
+
+// Serve hash requests on a Unix socket with max_workers warm worker threads;
+// socket_path NULL means dhash_default_socket. A socket file left at the path is
+// replaced only if it belongs to this user and nothing answers on it. Only
+// returns on a fatal error.
+int dhash_daemon_run(const char* socket_path, const dhash_opts* opts, dhash_metrics* metrics);
+
+typedef enum {
+    DHASH_ORDER_LARGEST,   // largest first: the big files do not finish last
+    DHASH_ORDER_SMALLEST,  // smallest first: most files finish soonest
+    DHASH_ORDER_INPUT      // as given
+} dhash_batch_order;
+
+#define DHASH_BATCH_SPLIT (1ull << 30)
+
+typedef struct {
+    dhash_batch_order order;  // within each class, files mostly in page cache going first
+    size_t mem_budget;        // read buffers and contexts in flight, 0 for no limit
+    uint64_t split_size;      // with max_workers > 1, files this large are hashed by all
+                              // workers together (segmented pipeline), 0 to never split
+} dhash_batch_opts;
+
+// Hash many files, one per worker, printing "digest  path" lines in input order
+// whatever order the scheduler hashes them in; with opts.sketch the lines are
+// "digest sketch  path" and no file is split
+int dhash_batch_run(char** files, int nfiles, const dhash_opts* opts, const dhash_batch_opts* sched,
+                    dhash_metrics* metrics);
+// Append the paths listed one per line in list_path ("-" for stdin) to *files
+int dhash_read_file_list(const char* list_path, char*** files, int* nfiles);
+
+// Print the similarity (0-100) of a and b, each a "dhs1:..." sketch or a file
+// to sketch (dhash_sketch.h)
+int dhash_compare_run(const char* a, const char* b, const dhash_opts* opts);
+// All-vs-all over the sketch lines of list_path ("-" for stdin), as printed by
+// --batch --sketch: "score  path_a  path_b" for every pair scoring at least
+// threshold, rows scored on max_workers threads
+int dhash_similar_run(const char* list_path, int threshold, int max_workers);
+
+#endif
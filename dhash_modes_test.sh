@@ -0,0 +1,146 @@
+#!/bin/sh
+# Command line modes against plain dhash on the same bytes.
+#
+#   sh dhash_modes_test.sh MODE DHASH_BINARY
+#
+# MODE is cdc, tar or decompress. Exits non-zero with a message on the first mismatch.
+set -eu
+
+mode=$1
+dhash=$2
+work=$(mktemp -d "${TMPDIR:-/tmp}/dhash-modes-XXXXXX")
+trap 'rm -rf "$work"' EXIT
+
+fail() {
+    echo "dhash_modes_test $mode: $*" >&2
+    exit 1
+}
+
+# The stream digest of a file, as plain dhash prints it
+digest_of() {
+    "$dhash" "$1" | tail -n 1 | cut -d' ' -f1
+}
+
+test_cdc() {
+    params=2048/8192/65536
+    # Past the 8 MiB read buffer, so cuts also fall across refills
+    head -c 20000000 /dev/urandom > "$work/a.bin"
+    "$dhash" --cdc "$params" "$work/a.bin" > "$work/a.cdc"
+    sed '$d' "$work/a.cdc" > "$work/a.chunks"
+
+    # Chunks tile the file and the last line is the stream digest
+    awk -v size=20000000 '
+        $1 != next_off { print "gap at " $1; bad = 1 }
+        { next_off = $1 + $2 }
+        END { if (next_off != size) { print "chunks end at " next_off; bad = 1 } exit bad }
+    ' "$work/a.chunks" || fail "chunks do not tile the file"
+    [ "$(tail -n 1 "$work/a.cdc" | cut -d' ' -f1)" = "$(digest_of "$work/a.bin")" ] \
+        || fail "whole-file line differs from dhash"
+
+    # Cutting from a chunk boundary halfway in gives the same chunks from there
+    # on, although the buffer refills now land elsewhere in the content
+    line=$(($(wc -l < "$work/a.chunks") / 2))
+    off=$(sed -n "${line}p" "$work/a.chunks" | cut -d' ' -f1)
+    tail -c +$((off + 1)) "$work/a.bin" > "$work/tail.bin"
+    "$dhash" --cdc "$params" "$work/tail.bin" | sed '$d' | cut -d' ' -f2,3 > "$work/tail.chunks"
+    tail -n +"$line" "$work/a.chunks" | cut -d' ' -f2,3 | cmp -s - "$work/tail.chunks" \
+        || fail "boundaries moved with the read offset"
+
+    # A prefix insertion only disturbs the chunks around it
+    { printf 'inserted at the front'; cat "$work/a.bin"; } > "$work/b.bin"
+    "$dhash" --cdc "$params" "$work/b.bin" | sed '$d' | cut -d' ' -f2,3 | sort > "$work/b.chunks"
+    cut -d' ' -f2,3 "$work/a.chunks" | sort > "$work/a.sorted"
+    total=$(wc -l < "$work/a.sorted")
+    kept=$(comm -12 "$work/a.sorted" "$work/b.chunks" | wc -l)
+    [ $((kept * 100)) -ge $((total * 95)) ] || fail "prefix insertion kept only $kept of $total chunks"
+
+    # Tiny minimum chunks no longer size the chunk table for the worst case
+    (ulimit -v 1000000 2>/dev/null; "$dhash" --cdc 1/8192/65536 "$work/a.bin" > /dev/null) \
+        || fail "--cdc 1/8192/65536 failed"
+}
+
+# Every "digest  member" line of --tar output in $1 against the member on disk
+check_members() {
+    sed '$d' "$1" > "$work/members"
+    [ -s "$work/members" ] || fail "$1: no members listed"
+    while read -r digest member; do
+        [ "$digest" = "$(digest_of "$work/src/$member")" ] || fail "$1: $member differs from dhash"
+    done < "$work/members"
+}
+
+test_tar() {
+    # A long name, a ustar prefix split, an empty file and a multi-block file
+    long=$(printf '%0150d' 0)
+    deep=$(printf 'd%.0s' $(seq 90))/$(printf 'e%.0s' $(seq 30))
+    mkdir -p "$work/src/$deep"
+    head -c 1000000 /dev/urandom > "$work/src/big.bin"
+    head -c 3000 /dev/urandom > "$work/src/$long"
+    head -c 513 /dev/urandom > "$work/src/$deep/f.bin"
+    : > "$work/src/empty"
+
+    for format in gnu pax ustar; do
+        if [ $format = ustar ]; then
+            set -- big.bin empty "$deep/f.bin"
+        else
+            set -- big.bin empty "$deep/f.bin" "$long"
+        fi
+        tar --format=$format -cf "$work/$format.tar" -C "$work/src" "$@"
+        "$dhash" --tar "$work/$format.tar" > "$work/$format.out" || fail "$format archive failed"
+        [ "$(wc -l < "$work/$format.out")" -eq $(($# + 1)) ] || fail "$format: wrong member count"
+        check_members "$work/$format.out"
+        [ "$(tail -n 1 "$work/$format.out" | cut -d' ' -f1)" = "$(digest_of "$work/$format.tar")" ] \
+            || fail "$format: archive line differs from dhash"
+    done
+    grep -q " $long\$" "$work/gnu.out" || fail "gnu long name not recovered"
+    grep -q " $long\$" "$work/pax.out" || fail "pax long name not recovered"
+
+    # The same stream from stdin
+    "$dhash" --tar - < "$work/gnu.tar" > "$work/stdin.out" || fail "stdin archive failed"
+    sed '$d' "$work/gnu.out" > "$work/gnu.members"
+    sed '$d' "$work/stdin.out" | cmp -s - "$work/gnu.members" || fail "stdin members differ"
+
+    # A cut archive and a header that no longer matches its checksum are errors
+    head -c 600000 "$work/gnu.tar" > "$work/cut.tar"
+    status=0
+    "$dhash" --tar "$work/cut.tar" > /dev/null 2>&1 || status=$?
+    [ $status -eq 1 ] || fail "truncated archive exited $status"
+    cp "$work/gnu.tar" "$work/bad.tar"
+    printf 'c' | dd of="$work/bad.tar" bs=1 seek=0 conv=notrunc 2>/dev/null
+    status=0
+    "$dhash" --tar "$work/bad.tar" > /dev/null 2>&1 || status=$?
+    [ $status -eq 1 ] || fail "bad header checksum exited $status"
+}
+
+test_decompress() {
+    # Committed BGZF fixture: four members with "BC" size fields (the last one
+    # the empty EOF block), so the parallel batch decoder takes it
+    fixture=$(dirname "$0")/dhash_modes_test.bgzf.gz
+    gzip -dc "$fixture" > "$work/bgzf.plain"
+    [ "$(digest_of "$work/bgzf.plain")" = "$("$dhash" --decompress "$fixture")" ] \
+        || fail "BGZF digest differs from the plain file"
+
+    # Concatenated plain gzip members go through the sequential inflater
+    head -c 300000 /dev/urandom > "$work/a.bin"
+    head -c 70000 /dev/urandom > "$work/b.bin"
+    cat "$work/a.bin" "$work/b.bin" > "$work/ab.bin"
+    { gzip -c "$work/a.bin"; gzip -c "$work/b.bin"; } > "$work/ab.gz"
+    want=$(digest_of "$work/ab.bin")
+    [ "$("$dhash" --decompress "$work/ab.gz")" = "$want" ] || fail "concatenated gzip differs"
+    [ "$("$dhash" --decompress - < "$work/ab.gz")" = "$want" ] || fail "concatenated gzip on stdin differs"
+
+    # Cut input is an error, BGZF or not
+    for f in "$fixture" "$work/ab.gz"; do
+        size=$(wc -c < "$f")
+        head -c $((size / 2)) "$f" > "$work/cut.gz"
+        status=0
+        "$dhash" --decompress "$work/cut.gz" > /dev/null 2>&1 || status=$?
+        [ $status -eq 1 ] || fail "truncated $(basename "$f") exited $status"
+    done
+}
+
+case $mode in
+    cdc) test_cdc ;;
+    tar) test_tar ;;
+    decompress) test_decompress ;;
+    *) fail "unknown mode" ;;
+esac
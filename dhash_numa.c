@@ -0,0 +1,258 @@
+#include "dhash_numa.h"
+#include "dhash_throttle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#define NODE_DIR "/sys/devices/system/node"
+
+// Parse a sysfs cpulist such as "0-7,16-23"
+static void parse_cpulist(const char* s, cpu_set_t* set) {
+    CPU_ZERO(set);
+    while (*s) {
+        char* end;
+        long a = strtol(s, &end, 10);
+        if (end == s) break;
+        long b = a;
+        if (*end == '-') b = strtol(end + 1, &end, 10);
+        for (long c = a; c <= b && c < CPU_SETSIZE; c++) CPU_SET(c, set);
+        s = (*end == ',') ? end + 1 : end;
+        if (*s == '\n') break;
+    }
+}
+
+static int node_index_sort(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+// Node ids present in sysfs, sorted
+static int list_nodes(int* ids) {
+    DIR* dir = opendir(NODE_DIR);
+    if (!dir) return 0;
+    int n = 0;
+    struct dirent* de;
+    while ((de = readdir(dir)) && n < DHASH_MAX_NODES) {
+        int id;
+        char tail;
+        if (sscanf(de->d_name, "node%d%c", &id, &tail) == 1) ids[n++] = id;
+    }
+    closedir(dir);
+    qsort(ids, n, sizeof(int), node_index_sort);
+    return n;
+}
+
+void dhash_numa_detect(dhash_numa_topology* topo) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        for (int c = 0; c < CPU_SETSIZE; c++) CPU_SET(c, &allowed);
+    }
+
+    int ids[DHASH_MAX_NODES];
+    int n = list_nodes(ids);
+    topo->nnodes = 0;
+    for (int i = 0; i < n; i++) {
+        char path[128], line[4096];
+        snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", ids[i]);
+        FILE* f = fopen(path, "r");
+        if (!f) continue;
+        if (fgets(line, sizeof(line), f)) {
+            cpu_set_t set;
+            parse_cpulist(line, &set);
+            CPU_AND(&set, &set, &allowed);
+            // Memory-only nodes and nodes outside our cpuset get no workers
+            if (CPU_COUNT(&set) > 0) {
+                topo->node_id[topo->nnodes] = ids[i];
+                topo->cpus[topo->nnodes] = set;
+                topo->nnodes++;
+            }
+        }
+        fclose(f);
+    }
+    if (topo->nnodes == 0) {
+        topo->nnodes = 1;
+        topo->node_id[0] = 0;
+        topo->cpus[0] = allowed;
+    }
+}
+
+int dhash_numa_bind(const dhash_numa_topology* topo, int node, cpu_set_t* saved) {
+    if (saved && sched_getaffinity(0, sizeof(*saved), saved) != 0) return -1;
+    return sched_setaffinity(0, sizeof(cpu_set_t), &topo->cpus[node % topo->nnodes]);
+}
+
+void dhash_numa_restore(const cpu_set_t* saved) {
+    sched_setaffinity(0, sizeof(*saved), saved);
+}
+
+void dhash_numa_sample(dhash_numa_stats* stats) {
+    int ids[DHASH_MAX_NODES];
+    stats->nnodes = list_nodes(ids);
+    for (int i = 0; i < stats->nnodes; i++) {
+        char path[128], key[64];
+        unsigned long long value;
+        stats->node_id[i] = ids[i];
+        stats->local[i] = stats->remote[i] = 0;
+        snprintf(path, sizeof(path), NODE_DIR "/node%d/numastat", ids[i]);
+        FILE* f = fopen(path, "r");
+        if (!f) continue;
+        while (fscanf(f, "%63s %llu", key, &value) == 2) {
+            if (strcmp(key, "local_node") == 0) stats->local[i] = value;
+            else if (strcmp(key, "other_node") == 0) stats->remote[i] = value;
+        }
+        fclose(f);
+    }
+}
+
+void dhash_numa_report(const dhash_numa_stats* before, const dhash_numa_stats* after) {
+    long page = sysconf(_SC_PAGESIZE);
+    fprintf(stderr, "NUMA page allocations during the run (system-wide, %ld-byte pages):\n", page);
+    for (int i = 0; i < after->nnodes && i < before->nnodes; i++) {
+        unsigned long long local = after->local[i] - before->local[i];
+        unsigned long long remote = after->remote[i] - before->remote[i];
+        double share = (local + remote) ? 100.0 * remote / (local + remote) : 0;
+        fprintf(stderr, "  node%d: local %llu, remote %llu (%.1f%% remote)\n",
+                after->node_id[i], local, remote, share);
+    }
+}
+
+static int pread_full(int fd, uint8_t* buf, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return -1;  // file shrank under us
+        buf += n;
+        len -= (size_t)n;
+        off += n;
+    }
+    return 0;
+}
+
+int dhash_numa_file(const char* filename, const dhash_opts* opts, unsigned char* out, size_t* out_len) {
+    if (strcmp(filename, "-") == 0) return dhash_file(filename, opts, out, out_len);
+    // Segments start one byte early to pick up prev, which O_DIRECT alignment forbids
+    dhash_opts read_opts = *opts;
+    read_opts.direct_io = 0;
+    int fd = dhash_open_input(filename, &read_opts);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return dhash_file(filename, opts, out, out_len);
+    }
+
+    dhash_numa_topology topo;
+    topo.nnodes = 1;
+    if (opts->numa) dhash_numa_detect(&topo);
+    int workers = opts->max_workers > topo.nnodes ? opts->max_workers : topo.nnodes;
+
+    // Whole chunks per segment so every segment transforms independently
+    size_t chunk = opts->chunk_size;
+    size_t seg = (opts->block_size + chunk - 1) / chunk * chunk;
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t nseg = (size + seg - 1) / seg;
+    uint64_t rounds = (nseg + workers - 1) / workers;
+
+    dhash_opts digest_opts = *opts;
+    digest_opts.max_workers = 1;
+    dhash_ctx* ctx = dhash_ctx_new(&digest_opts);
+    dhash_buffer* in = calloc(workers, sizeof(*in));
+    dhash_buffer* outbuf = calloc(2 * (size_t)workers, sizeof(*outbuf));
+    size_t* seglen = calloc(2 * (size_t)workers, sizeof(*seglen));
+    int error = !ctx || !in || !outbuf || !seglen;
+
+    if (!error) {
+        // One extra thread digests round r - 1 while the workers transform round r
+#pragma omp parallel num_threads(workers + 1)
+        {
+            int tid = omp_get_thread_num();
+            int digester = (tid == workers);
+            int node = digester ? 0 : tid % topo.nnodes;
+            cpu_set_t saved;
+            int pinned = opts->numa && dhash_numa_bind(&topo, node, &saved) == 0;
+
+            if (!digester) {
+                // Allocated and first-touched by the pinned thread, so local to its node
+                if (dhash_buffer_alloc(&in[tid], seg + 1, opts->huge_pages) != 0
+                    || dhash_buffer_alloc(&outbuf[2 * tid], seg, opts->huge_pages) != 0
+                    || dhash_buffer_alloc(&outbuf[2 * tid + 1], seg, opts->huge_pages) != 0) {
+#pragma omp atomic write
+                    error = 1;
+                } else {
+                    memset(in[tid].data, 0, in[tid].size);
+                    memset(outbuf[2 * tid].data, 0, seg);
+                    memset(outbuf[2 * tid + 1].data, 0, seg);
+                }
+            }
+#pragma omp barrier
+
+            for (uint64_t r = 0; r <= rounds; r++) {
+                int failed;
+#pragma omp atomic read
+                failed = error;
+                if (failed) {
+                    // Keep hitting the barrier so no thread waits forever
+                } else if (!digester && r < rounds) {
+                    uint64_t k = r * workers + tid;
+                    size_t* len = &seglen[2 * tid + (r & 1)];
+                    *len = 0;
+                    if (k < nseg) {
+                        uint64_t off = k * seg;
+                        size_t n = (size - off < seg) ? (size_t)(size - off) : seg;
+                        size_t lead = off ? 1 : 0;
+                        if (pread_full(fd, in[tid].data, n + lead, (off_t)(off - lead)) != 0) {
+                            perror("Failed to read file");
+#pragma omp atomic write
+                            error = 1;
+                        } else {
+                            dhash_throttle_read(opts->throttle, n);
+                            dhash_throttle_transform(opts->throttle, n);
+                            uint8_t prev = lead ? in[tid].data[0] : 0;
+                            dhash_transform_run(opts, in[tid].data + lead, n, off, prev,
+                                                outbuf[2 * tid + (r & 1)].data);
+                            *len = n;
+                        }
+                    }
+                } else if (digester && r > 0) {
+                    for (int t = 0; t < workers; t++) {
+                        size_t idx = 2 * t + ((r - 1) & 1);
+                        if (seglen[idx] && dhash_update_transformed(ctx, outbuf[idx].data, seglen[idx]) != 0) {
+#pragma omp atomic write
+                            error = 1;
+                            break;
+                        }
+                    }
+                }
+#pragma omp barrier
+            }
+            if (pinned) dhash_numa_restore(&saved);
+        }
+    }
+
+    int rc = error ? -1 : dhash_final(ctx, out, out_len);
+
+    for (int t = 0; in && outbuf && t < workers; t++) {
+        dhash_buffer_free(&in[t]);
+        dhash_buffer_free(&outbuf[2 * t]);
+        dhash_buffer_free(&outbuf[2 * t + 1]);
+    }
+    free(in);
+    free(outbuf);
+    free(seglen);
+    dhash_ctx_free(ctx);
+    close(fd);
+    return rc;
+}
@@ -0,0 +1,49 @@
+#ifndef DHASH_NUMA_H
+#define DHASH_NUMA_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // cpu_set_t; include this header first
+#endif
+#include <sched.h>
+#include <stdint.h>
+
+#include "dhash.h"
+
+#define DHASH_MAX_NODES 64
+
+// NUMA nodes restricted to the CPUs this process may run on
+typedef struct {
+    int nnodes;
+    int node_id[DHASH_MAX_NODES];
+    cpu_set_t cpus[DHASH_MAX_NODES];
+} dhash_numa_topology;
+
+// Read /sys/devices/system/node; a machine without it is one node
+void dhash_numa_detect(dhash_numa_topology* topo);
+// Pin the calling thread to the CPUs of topology node index, first saving its
+// current affinity in saved unless that is NULL
+int dhash_numa_bind(const dhash_numa_topology* topo, int node, cpu_set_t* saved);
+// Give the calling thread back the affinity dhash_numa_bind saved; OpenMP
+// reuses its threads, the caller's own among them, so every pinned region ends
+// with this
+void dhash_numa_restore(const cpu_set_t* saved);
+
+// Per-node numa_hit/local_node/other_node counters from sysfs
+typedef struct {
+    int nnodes;
+    int node_id[DHASH_MAX_NODES];
+    unsigned long long local[DHASH_MAX_NODES];
+    unsigned long long remote[DHASH_MAX_NODES];
+} dhash_numa_stats;
+
+void dhash_numa_sample(dhash_numa_stats* stats);
+// Print the local/remote allocation deltas between two samples to stderr
+void dhash_numa_report(const dhash_numa_stats* before, const dhash_numa_stats* after);
+
+// Hash a regular file with workers pinned per node (when opts->numa): every
+// worker reads and transforms its own segments into buffers it first-touched on
+// its node while a separate thread digests the previous round. Falls back to
+// dhash_file for inputs that cannot be read with pread().
+int dhash_numa_file(const char* filename, const dhash_opts* opts, unsigned char* out, size_t* out_len);
+
+#endif
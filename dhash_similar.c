@@ -0,0 +1,120 @@
+#include "dhash_modes.h"
+#include "dhash_sketch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+// A sketch given on the command line, or a file to sketch
+static int load_operand(const char* arg, const dhash_opts* opts, dhash_sketch* out) {
+    if (strncmp(arg, DHASH_SKETCH_PREFIX, strlen(DHASH_SKETCH_PREFIX)) == 0) {
+        if (dhash_sketch_parse(arg, out) == 0) return 0;
+        fprintf(stderr, "Malformed sketch: %.16s...\n", arg);
+        return -1;
+    }
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t len = 0;
+    return dhash_file_sketch(arg, opts, digest, &len, out);
+}
+
+int dhash_compare_run(const char* a, const char* b, const dhash_opts* opts) {
+    dhash_sketch sa, sb;
+    if (load_operand(a, opts, &sa) != 0 || load_operand(b, opts, &sb) != 0) return 1;
+    printf("%d\n", dhash_sketch_compare(&sa, &sb));
+    return 0;
+}
+
+typedef struct {
+    dhash_sketch sketch;
+    char* path;
+} sketch_entry;
+
+typedef struct {
+    size_t j;
+    int score;
+} sketch_hit;
+
+// "<digest> dhs1:...  <path>" as printed by --batch --sketch, or "dhs1:...  <path>"
+static int parse_entry(char* line, sketch_entry* e) {
+    char* tok = strstr(line, DHASH_SKETCH_PREFIX);
+    if (!tok || (tok != line && tok[-1] != ' ') || dhash_sketch_parse(tok, &e->sketch) != 0) return -1;
+    char* path = tok + DHASH_SKETCH_TEXT - 1;
+    while (*path == ' ' || *path == '\t') path++;
+    e->path = strdup(path);
+    return e->path ? 0 : -1;
+}
+
+int dhash_similar_run(const char* list_path, int threshold, int max_workers) {
+    FILE* f = strcmp(list_path, "-") == 0 ? stdin : fopen(list_path, "r");
+    if (!f) {
+        perror(list_path);
+        return 1;
+    }
+    sketch_entry* entries = NULL;
+    size_t n = 0, cap = 0;
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t got;
+    long lineno = 0;
+    int rc = 0;
+    while ((got = getline(&line, &line_cap, f)) >= 0) {
+        lineno++;
+        if (got > 0 && line[got - 1] == '\n') line[--got] = '\0';
+        if (got == 0) continue;
+        if (n == cap) {
+            size_t new_cap = cap ? 2 * cap : 1024;
+            sketch_entry* p = realloc(entries, new_cap * sizeof(*entries));
+            if (!p) {
+                perror("Failed to allocate sketches");
+                rc = 1;
+                break;
+            }
+            entries = p;
+            cap = new_cap;
+        }
+        if (parse_entry(line, &entries[n]) != 0) {
+            fprintf(stderr, "%s:%ld: no sketch\n", list_path, lineno);
+            continue;
+        }
+        n++;
+    }
+    free(line);
+    if (f != stdin) fclose(f);
+
+    // Each row is scored in parallel and printed in order: "score  path_a  path_b"
+    // for every later entry scoring at least threshold
+    if (rc == 0) {
+#pragma omp parallel for num_threads(max_workers) schedule(dynamic, 16) ordered
+        for (size_t i = 0; i < n; i++) {
+            sketch_hit* hits = NULL;
+            size_t nhits = 0, hits_cap = 0;
+            for (size_t j = i + 1; j < n; j++) {
+                int score = dhash_sketch_compare(&entries[i].sketch, &entries[j].sketch);
+                if (score < threshold) continue;
+                if (nhits == hits_cap) {
+                    size_t new_cap = hits_cap ? 2 * hits_cap : 16;
+                    sketch_hit* p = realloc(hits, new_cap * sizeof(*hits));
+                    if (!p) {
+                        perror("Failed to allocate matches");
+                        __atomic_store_n(&rc, 1, __ATOMIC_RELAXED);
+                        break;
+                    }
+                    hits = p;
+                    hits_cap = new_cap;
+                }
+                hits[nhits].j = j;
+                hits[nhits++].score = score;
+            }
+#pragma omp ordered
+            for (size_t k = 0; k < nhits; k++) {
+                printf("%d  %s  %s\n", hits[k].score, entries[i].path, entries[hits[k].j].path);
+            }
+            free(hits);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) free(entries[i].path);
+    free(entries);
+    return rc;
+}
@@ -0,0 +1,115 @@
+#include "dhash_sketch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Top 7 bits of a shingle hash choose one of the 128 bins
+#define BIN_SHIFT 57
+
+// splitmix64 finalizer: a bijection, so distinct shingles never collide
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void dhash_sketch_begin(dhash_sketch_state* s) {
+    for (int i = 0; i < DHASH_SKETCH_BINS; i++) s->min[i] = UINT64_MAX;
+    s->window = 0;
+    s->seen = 0;
+}
+
+DHASH_CLONES
+void dhash_sketch_update(dhash_sketch_state* s, const uint8_t* data, size_t len) {
+    uint64_t w = s->window;
+    size_t i = 0;
+    // The first shingle ends on the stream's eighth byte
+    if (s->seen < DHASH_SKETCH_SHINGLE - 1) {
+        size_t warm = DHASH_SKETCH_SHINGLE - 1 - s->seen;
+        for (; i < len && i < warm; i++) w = (w << 8) | data[i];
+    }
+    for (; i < len; i++) {
+        w = (w << 8) | data[i];
+        uint64_t h = mix64(w);
+        uint64_t* m = &s->min[h >> BIN_SHIFT];
+        if (h < *m) *m = h;
+    }
+    s->window = w;
+    s->seen += len;
+}
+
+void dhash_sketch_end(const dhash_sketch_state* s, dhash_sketch* out) {
+    for (int i = 0; i < DHASH_SKETCH_BINS; i++) {
+        if (s->min[i] == UINT64_MAX) {
+            out->bin[i] = DHASH_SKETCH_EMPTY;
+            continue;
+        }
+        // 16 bits of a rehash of the minimum; two different minima agree by
+        // chance 1 in 65535
+        uint16_t v = (uint16_t)(mix64(s->min[i] ^ 0x9e3779b97f4a7c15ULL) >> 48);
+        out->bin[i] = v == DHASH_SKETCH_EMPTY ? DHASH_SKETCH_EMPTY - 1 : v;
+    }
+}
+
+int dhash_sketch_compare(const dhash_sketch* a, const dhash_sketch* b) {
+    int shared = 0, both_empty = 0;
+#ifdef __SSE2__
+    // Eight bins per compare; a bin equal in both is shared unless it is empty
+    const __m128i empty = _mm_set1_epi16((short)DHASH_SKETCH_EMPTY);
+    for (int i = 0; i < DHASH_SKETCH_BINS; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a->bin + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b->bin + i));
+        __m128i eq = _mm_cmpeq_epi16(x, y);
+        __m128i ex = _mm_cmpeq_epi16(x, empty);
+        shared += __builtin_popcount(_mm_movemask_epi8(_mm_andnot_si128(ex, eq)));
+        both_empty += __builtin_popcount(_mm_movemask_epi8(_mm_and_si128(ex, eq)));
+    }
+    shared /= 2;  // two mask bits per 16-bit lane
+    both_empty /= 2;
+#else
+    for (int i = 0; i < DHASH_SKETCH_BINS; i++) {
+        if (a->bin[i] != b->bin[i]) continue;
+        if (a->bin[i] == DHASH_SKETCH_EMPTY) both_empty++;
+        else shared++;
+    }
+#endif
+    int used = DHASH_SKETCH_BINS - both_empty;
+    return used ? 100 * shared / used : 0;
+}
+
+void dhash_sketch_format(const dhash_sketch* sketch, char* out) {
+    static const char digits[] = "0123456789abcdef";
+    strcpy(out, DHASH_SKETCH_PREFIX);
+    char* p = out + strlen(DHASH_SKETCH_PREFIX);
+    for (int i = 0; i < DHASH_SKETCH_BINS; i++) {
+        for (int shift = 12; shift >= 0; shift -= 4) *p++ = digits[(sketch->bin[i] >> shift) & 0xf];
+    }
+    *p = '\0';
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int dhash_sketch_parse(const char* s, dhash_sketch* out) {
+    size_t plen = strlen(DHASH_SKETCH_PREFIX);
+    if (strncmp(s, DHASH_SKETCH_PREFIX, plen) != 0) return -1;
+    s += plen;
+    for (int i = 0; i < DHASH_SKETCH_BINS; i++) {
+        uint16_t v = 0;
+        for (int k = 0; k < 4; k++) {
+            int d = hex_digit(*s++);
+            if (d < 0) return -1;
+            v = (uint16_t)(v << 4 | d);
+        }
+        out->bin[i] = v;
+    }
+    // Followed by the end of the token
+    return (*s == '\0' || *s == ' ' || *s == '\t' || *s == '\n') ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+#ifndef DHASH_SKETCH_H
+#define DHASH_SKETCH_H
+
+#include "dhash.h"
+
+// Similarity sketch for near-duplicate triage, built from the transformed byte
+// stream as it is digested (dhash_opts.sketch), so it costs no second read.
+// One-permutation MinHash: every 8-byte shingle is hashed once, the top bits
+// pick one of DHASH_SKETCH_BINS bins and each bin keeps its smallest hash.
+// The fraction of bins two sketches share estimates the Jaccard similarity of
+// their shingle sets. The transform only looks one byte either side, so an
+// edit disturbs the shingles around it and nothing else.
+
+#define DHASH_SKETCH_BINS 128
+#define DHASH_SKETCH_SHINGLE 8
+#define DHASH_SKETCH_EMPTY 0xffff  // bin no shingle fell into
+#define DHASH_SKETCH_PREFIX "dhs1:"
+#define DHASH_SKETCH_TEXT (5 + 4 * DHASH_SKETCH_BINS + 1)  // dhash_sketch_format output, with the terminator
+
+typedef struct {
+    uint16_t bin[DHASH_SKETCH_BINS];  // 16 bits of each bin's minimum, or DHASH_SKETCH_EMPTY
+} dhash_sketch;
+
+typedef struct {
+    uint64_t min[DHASH_SKETCH_BINS];
+    uint64_t window;  // last DHASH_SKETCH_SHINGLE bytes
+    uint64_t seen;
+} dhash_sketch_state;
+
+void dhash_sketch_begin(dhash_sketch_state* s);
+// Continue the shingle stream; splits anywhere give the same sketch
+void dhash_sketch_update(dhash_sketch_state* s, const uint8_t* data, size_t len);
+void dhash_sketch_end(const dhash_sketch_state* s, dhash_sketch* out);
+
+// Sketch of everything digested by ctx, after dhash_final; -1 unless the
+// context was created with opts.sketch
+int dhash_ctx_sketch(const dhash_ctx* ctx, dhash_sketch* out);
+// dhash_file, also returning the sketch of the same pass
+int dhash_file_sketch(const char* filename, const dhash_opts* opts, unsigned char* out, size_t* out_len,
+                      dhash_sketch* sketch);
+
+// Estimated similarity in percent (0-100) over the bins used by either sketch;
+// inputs too short for a single shingle score 0 (identical ones still share
+// the digest)
+int dhash_sketch_compare(const dhash_sketch* a, const dhash_sketch* b);
+
+// "dhs1:" and the bins as hex (out must hold DHASH_SKETCH_TEXT chars)
+void dhash_sketch_format(const dhash_sketch* sketch, char* out);
+// Parse dhash_sketch_format output at the start of s; returns 0 or -1
+int dhash_sketch_parse(const char* s, dhash_sketch* out);
+
+#endif
@@ -0,0 +1,309 @@
+#include "dhash_modes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+
+#define TAR_BLOCK 512
+#define TAR_READ_SLOTS 4
+#define TAR_MAX_META (1 << 20)  // longest pax header or GNU long name we accept
+
+typedef enum { TAR_HEADER, TAR_DATA, TAR_PAD, TAR_END } tar_state;
+
+typedef enum {
+    MEMBER_HASH,    // regular file data
+    MEMBER_META,    // pax 'x' or GNU 'L' data, kept for the next member
+    MEMBER_SKIP     // everything else (pax globals, GNU long link names, ...)
+} member_kind;
+
+typedef struct {
+    tar_state state;
+    uint8_t header[TAR_BLOCK];
+    size_t have;           // bytes of header collected
+    uint64_t offset;       // stream offset of the parser
+    uint64_t remaining;    // data or padding bytes left
+    uint64_t padding;      // padding after the current member's data
+    int zero_blocks;
+
+    member_kind kind;
+    char type;
+    char* meta;            // collected pax / long name data
+    size_t meta_len;
+    char* long_name;       // GNU 'L' name for the next member
+    char* pax_path;        // pax path for the next member
+    int pax_has_size;
+    uint64_t pax_size;
+    char path[4096];
+
+    dhash_ctx* ctx;
+    int error;
+} tar_parser;
+
+// Octal field, or GNU base-256 when the top bit of the first byte is set
+static uint64_t tar_number(const uint8_t* field, size_t len) {
+    uint64_t v = 0;
+    if (field[0] & 0x80) {
+        v = field[0] & 0x3f;
+        for (size_t i = 1; i < len; i++) v = (v << 8) | field[i];
+        return v;
+    }
+    size_t i = 0;
+    while (i < len && (field[i] == ' ' || field[i] == '\0')) i++;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) v = (v << 3) | (uint64_t)(field[i] - '0');
+    return v;
+}
+
+static int tar_checksum_ok(const uint8_t* h) {
+    uint64_t want = tar_number(h + 148, 8);
+    uint64_t sum = 0;
+    int64_t ssum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        uint8_t b = (i >= 148 && i < 156) ? ' ' : h[i];
+        sum += b;
+        ssum += (int8_t)b;  // some historic tars summed signed chars
+    }
+    return want == sum || (int64_t)want == ssum;
+}
+
+static void copy_field(char* dst, const uint8_t* src, size_t len) {
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+// Records are "<len> <key>=<value>\n"; only path and size matter here
+static void parse_pax(tar_parser* p) {
+    size_t i = 0;
+    while (i < p->meta_len) {
+        char* end = NULL;
+        unsigned long len = strtoul(p->meta + i, &end, 10);
+        if (end == p->meta + i || *end != ' ' || len == 0 || i + len > p->meta_len) break;
+        char* key = end + 1;
+        char* rec_end = p->meta + i + len - 1;  // the trailing newline
+        char* eq = memchr(key, '=', (size_t)(rec_end - key));
+        if (eq) {
+            size_t vlen = (size_t)(rec_end - eq - 1);
+            if ((size_t)(eq - key) == 4 && memcmp(key, "path", 4) == 0) {
+                free(p->pax_path);
+                p->pax_path = strndup(eq + 1, vlen);
+            } else if ((size_t)(eq - key) == 4 && memcmp(key, "size", 4) == 0) {
+                p->pax_size = strtoull(eq + 1, NULL, 10);
+                p->pax_has_size = 1;
+            }
+        }
+        i += len;
+    }
+}
+
+static void begin_member(tar_parser* p) {
+    const uint8_t* h = p->header;
+    char name[101], prefix[156];
+    p->type = (char)h[156];
+    uint64_t size = tar_number(h + 124, 12);
+
+    if (p->type == 'x' || p->type == 'L') {
+        p->kind = MEMBER_META;
+    } else if (p->type == '0' || p->type == '\0' || p->type == '7') {
+        p->kind = MEMBER_HASH;
+    } else {
+        p->kind = MEMBER_SKIP;
+    }
+    // Links, devices and directories carry no data whatever their size says
+    if (p->type == '1' || p->type == '2' || p->type == '3' || p->type == '4'
+        || p->type == '5' || p->type == '6') {
+        size = 0;
+    }
+
+    if (p->kind != MEMBER_META) {
+        if (p->pax_has_size) size = p->pax_size;
+        if (p->pax_path) {
+            snprintf(p->path, sizeof(p->path), "%s", p->pax_path);
+        } else if (p->long_name) {
+            snprintf(p->path, sizeof(p->path), "%s", p->long_name);
+        } else {
+            copy_field(name, h, 100);
+            copy_field(prefix, h + 345, 155);
+            int ustar = memcmp(h + 257, "ustar", 5) == 0;
+            if (ustar && prefix[0] && memcmp(h + 257, "ustar  ", 7) != 0) {
+                snprintf(p->path, sizeof(p->path), "%s/%s", prefix, name);
+            } else {
+                snprintf(p->path, sizeof(p->path), "%s", name);
+            }
+        }
+        // Extended names apply to this member only
+        free(p->pax_path);
+        free(p->long_name);
+        p->pax_path = p->long_name = NULL;
+        p->pax_has_size = 0;
+    }
+
+    if (p->kind == MEMBER_META) {
+        if (size > TAR_MAX_META) {
+            fprintf(stderr, "tar: extended header of %llu bytes at offset %llu is too large\n",
+                    (unsigned long long)size, (unsigned long long)p->offset);
+            p->error = 1;
+            return;
+        }
+        p->meta = malloc(size + 1);
+        p->meta_len = 0;
+        if (!p->meta) {
+            perror("Failed to allocate tar header");
+            p->error = 1;
+            return;
+        }
+    } else if (p->kind == MEMBER_HASH && dhash_ctx_reset(p->ctx) != 0) {
+        p->error = 1;
+        return;
+    }
+    p->remaining = size;
+    p->padding = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+    p->state = TAR_DATA;
+}
+
+static void end_member(tar_parser* p) {
+    if (p->kind == MEMBER_HASH) {
+        unsigned char digest[DHASH_MAX_DIGEST];
+        char hex[DHASH_FORMAT_MAX];
+        size_t len = 0;
+        if (dhash_final(p->ctx, digest, &len) != 0) {
+            p->error = 1;
+            return;
+        }
+        dhash_format(dhash_ctx_opts(p->ctx), digest, len, hex);
+        printf("%s  %s\n", hex, p->path);
+    } else if (p->kind == MEMBER_META) {
+        p->meta[p->meta_len] = '\0';
+        if (p->type == 'x') {
+            parse_pax(p);
+        } else {
+            free(p->long_name);
+            p->long_name = strdup(p->meta);
+        }
+        free(p->meta);
+        p->meta = NULL;
+    }
+}
+
+// Consume len bytes of the archive
+static void tar_feed(tar_parser* p, const uint8_t* data, size_t len) {
+    while (len > 0 && !p->error) {
+        size_t n;
+        switch (p->state) {
+            case TAR_HEADER:
+                n = TAR_BLOCK - p->have < len ? TAR_BLOCK - p->have : len;
+                memcpy(p->header + p->have, data, n);
+                p->have += n;
+                if (p->have == TAR_BLOCK) {
+                    p->have = 0;
+                    int zero = 1;
+                    for (int i = 0; i < TAR_BLOCK && zero; i++) zero = p->header[i] == 0;
+                    if (zero) {
+                        // Two zero blocks end the archive; the rest is record padding
+                        if (++p->zero_blocks == 2) p->state = TAR_END;
+                    } else if (!tar_checksum_ok(p->header)) {
+                        fprintf(stderr, "tar: bad header checksum at offset %llu\n",
+                                (unsigned long long)(p->offset + n - TAR_BLOCK));
+                        p->error = 1;
+                    } else {
+                        p->zero_blocks = 0;
+                        begin_member(p);
+                    }
+                }
+                break;
+            case TAR_DATA:
+                n = p->remaining < len ? (size_t)p->remaining : len;
+                if (p->kind == MEMBER_HASH) {
+                    if (dhash_update(p->ctx, data, n) != 0) p->error = 1;
+                } else if (p->kind == MEMBER_META) {
+                    memcpy(p->meta + p->meta_len, data, n);
+                    p->meta_len += n;
+                }
+                p->remaining -= n;
+                if (p->remaining == 0) {
+                    end_member(p);
+                    p->remaining = p->padding;
+                    p->state = TAR_PAD;
+                }
+                break;
+            case TAR_PAD:
+                n = p->remaining < len ? (size_t)p->remaining : len;
+                p->remaining -= n;
+                break;
+            case TAR_END:
+            default:
+                n = len;
+                break;
+        }
+        if (p->state == TAR_PAD && p->remaining == 0) p->state = TAR_HEADER;
+        data += n;
+        len -= n;
+        p->offset += n;
+    }
+}
+
+int dhash_tar_file(const char* filename, const dhash_opts* opts) {
+    int is_stdin = strcmp(filename, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : dhash_open_input(filename, opts);
+    if (fd < 0) {
+        perror(filename);
+        return 1;
+    }
+
+    tar_parser p;
+    memset(&p, 0, sizeof(p));
+    p.ctx = dhash_ctx_new(opts);
+    dhash_ctx* archive = dhash_ctx_new(opts);
+    void* decoder = NULL;
+    dhash_reader* reader = NULL;
+    if (p.ctx && archive) {
+        reader = opts->decompress ? dhash_decompress_start(fd, opts, &decoder)
+                                  : dhash_reader_start(fd, opts, TAR_READ_SLOTS);
+    }
+    int rc = reader ? 0 : 1;
+
+    // The reader thread runs ahead while one thread parses and digests the
+    // members and another digests the archive as a whole
+    while (rc == 0) {
+        const uint8_t* data;
+        ssize_t n = dhash_reader_next(reader, &data);
+        if (n < 0) rc = 1;
+        if (n <= 0) break;
+        int archive_error = 0;
+#pragma omp parallel sections num_threads(2)
+        {
+#pragma omp section
+            archive_error = dhash_update(archive, data, (size_t)n) != 0;
+#pragma omp section
+            tar_feed(&p, data, (size_t)n);
+        }
+        if (archive_error || p.error) rc = 1;
+    }
+
+    if (rc == 0 && p.state != TAR_END && !(p.state == TAR_HEADER && p.have == 0 && p.offset > 0)) {
+        fprintf(stderr, "tar: %s: unexpected end of archive\n", filename);
+        rc = 1;
+    }
+    if (rc == 0) {
+        unsigned char digest[DHASH_MAX_DIGEST];
+        char hex[DHASH_FORMAT_MAX];
+        size_t len = 0;
+        if (dhash_final(archive, digest, &len) == 0) {
+            dhash_format(opts, digest, len, hex);
+            printf("%s  %s\n", hex, filename);
+        } else {
+            rc = 1;
+        }
+    }
+
+    if (decoder) dhash_decompress_stop(reader, decoder);
+    else dhash_reader_stop(reader);
+    dhash_ctx_free(archive);
+    dhash_ctx_free(p.ctx);
+    free(p.meta);
+    free(p.long_name);
+    free(p.pax_path);
+    if (!is_stdin) close(fd);
+    return rc;
+}
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include "dhash_throttle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// From linux/ioprio.h, which is not installed everywhere
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+#define PSI_CHECK_INTERVAL 1.0
+#define PSI_MAX_BACKOFF 5.0
+
+// Token bucket that may go into debt: callers take what they used and sleep
+// off any deficit, so a single large read never deadlocks on a small burst
+typedef struct {
+    double rate;     // bytes per second, 0 = unlimited
+    double burst;
+    double tokens;
+    double stamp;
+} bucket;
+
+struct dhash_throttle {
+    pthread_mutex_t lock;
+    dhash_throttle_opts opts;
+    bucket read;
+    bucket transform;
+    double psi_checked;
+    double psi_backoff;  // current pause while under pressure
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_seconds(double s) {
+    if (s <= 0) return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)s;
+    ts.tv_nsec = (long)((s - (double)ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static void bucket_init(bucket* b, double rate) {
+    b->rate = rate;
+    // A tenth of a second of credit, but never less than one large read
+    b->burst = rate / 10 > (1 << 20) ? rate / 10 : (1 << 20);
+    b->tokens = b->burst;
+    b->stamp = now_seconds();
+}
+
+// Returns how long the caller must sleep; called with the throttle lock held
+static double bucket_take(bucket* b, size_t bytes) {
+    if (b->rate <= 0) return 0;
+    double now = now_seconds();
+    b->tokens += (now - b->stamp) * b->rate;
+    if (b->tokens > b->burst) b->tokens = b->burst;
+    b->stamp = now;
+    b->tokens -= (double)bytes;
+    return b->tokens < 0 ? -b->tokens / b->rate : 0;
+}
+
+dhash_throttle* dhash_throttle_new(const dhash_throttle_opts* opts) {
+    dhash_throttle* t = calloc(1, sizeof(*t));
+    if (!t) {
+        perror("Failed to allocate throttle");
+        return NULL;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    t->opts = *opts;
+    bucket_init(&t->read, opts->read_bps);
+    bucket_init(&t->transform, opts->transform_bps);
+    return t;
+}
+
+void dhash_throttle_free(dhash_throttle* t) {
+    if (!t) return;
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
+
+int dhash_throttle_apply_priority(const dhash_throttle* t) {
+    if (!t || !t->opts.idle_priority) return 0;
+    int rc = 0;
+    // Threads inherit both settings from their creator
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0) {
+        perror("ioprio_set");
+        rc = -1;
+    }
+    struct sched_param param = { 0 };
+    if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+        perror("sched_setscheduler(SCHED_IDLE)");
+        rc = -1;
+    }
+    return rc;
+}
+
+// Highest "some avg10" of /proc/pressure/{cpu,io}, or -1 without PSI support
+static double read_pressure(void) {
+    static const char* files[] = { "/proc/pressure/cpu", "/proc/pressure/io" };
+    double worst = -1;
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        FILE* f = fopen(files[i], "r");
+        if (!f) continue;
+        double avg10;
+        if (fscanf(f, "some avg10=%lf", &avg10) == 1 && avg10 > worst) worst = avg10;
+        fclose(f);
+    }
+    return worst;
+}
+
+// Pause with growing back-off while the host reports pressure over the threshold
+static void psi_wait(dhash_throttle* t) {
+    if (t->opts.psi_threshold <= 0) return;
+    for (;;) {
+        double pause = 0;
+        pthread_mutex_lock(&t->lock);
+        double now = now_seconds();
+        if (now - t->psi_checked >= PSI_CHECK_INTERVAL) {
+            t->psi_checked = now;
+            if (read_pressure() > t->opts.psi_threshold) {
+                t->psi_backoff = t->psi_backoff > 0 ? t->psi_backoff * 2 : 0.1;
+                if (t->psi_backoff > PSI_MAX_BACKOFF) t->psi_backoff = PSI_MAX_BACKOFF;
+            } else {
+                t->psi_backoff = 0;
+            }
+        }
+        pause = t->psi_backoff;
+        pthread_mutex_unlock(&t->lock);
+        if (pause <= 0) return;
+        sleep_seconds(pause);
+    }
+}
+
+void dhash_throttle_read(dhash_throttle* t, size_t bytes) {
+    if (!t) return;
+    pthread_mutex_lock(&t->lock);
+    double wait = bucket_take(&t->read, bytes);
+    pthread_mutex_unlock(&t->lock);
+    sleep_seconds(wait);
+    psi_wait(t);
+}
+
+void dhash_throttle_transform(dhash_throttle* t, size_t bytes) {
+    if (!t) return;
+    pthread_mutex_lock(&t->lock);
+    double wait = bucket_take(&t->transform, bytes);
+    pthread_mutex_unlock(&t->lock);
+    sleep_seconds(wait);
+}
+
+int dhash_throttle_drops_cache(const dhash_throttle* t) {
+    return t && t->opts.drop_cache;
+}
+
+ssize_t dhash_page_residency(int fd, off_t off, size_t len, unsigned char** vec) {
+    long page = sysconf(_SC_PAGESIZE);
+    off_t start = off - off % page;
+    size_t span = len + (size_t)(off - start);
+    size_t pages = (span + page - 1) / page;
+    if (pages == 0) return 0;
+
+    void* map = mmap(NULL, span, PROT_READ, MAP_SHARED, fd, start);
+    if (map == MAP_FAILED) return -1;
+    unsigned char* v = malloc(pages);
+    if (!v || mincore(map, span, v) != 0) {
+        free(v);
+        munmap(map, span);
+        return -1;
+    }
+    munmap(map, span);
+    *vec = v;
+    return (ssize_t)pages;
+}
@@ -0,0 +1,37 @@
+#ifndef DHASH_THROTTLE_H
+#define DHASH_THROTTLE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "dhash.h"
+
+#define DHASH_PSI_DEFAULT 10.0  // percent of time stalled (avg10) before backing off
+
+typedef struct {
+    double read_bps;        // read bandwidth limit in bytes/s, 0 = unlimited
+    double transform_bps;   // transformed bytes/s limit, 0 = unlimited
+    int idle_priority;      // idle I/O class and SCHED_IDLE for every thread
+    int drop_cache;         // evict pages we pulled into the page cache
+    double psi_threshold;   // back off while CPU or I/O pressure exceeds this, 0 = off
+} dhash_throttle_opts;
+
+// Shared by all workers; NULL disables every limit
+dhash_throttle* dhash_throttle_new(const dhash_throttle_opts* opts);
+void dhash_throttle_free(dhash_throttle* t);
+
+// Switch the calling thread (and threads it creates afterwards) to the idle I/O
+// class and SCHED_IDLE; call before any worker threads exist
+int dhash_throttle_apply_priority(const dhash_throttle* t);
+
+// Account for bytes just read/transformed, sleeping as needed to respect the limits
+void dhash_throttle_read(dhash_throttle* t, size_t bytes);
+void dhash_throttle_transform(dhash_throttle* t, size_t bytes);
+
+int dhash_throttle_drops_cache(const dhash_throttle* t);
+
+// Page cache residency of [off, off + len) of fd, one byte per page (bit 0 set
+// when resident). Returns the page count, or -1 if it cannot be determined.
+ssize_t dhash_page_residency(int fd, off_t off, size_t len, unsigned char** vec);
+
+#endif
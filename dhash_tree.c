@@ -0,0 +1,573 @@
+#define _GNU_SOURCE
+#include "dhash_modes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <omp.h>
+
+#define TREE_VERSION 1
+#define TREE_PIPELINE 2        // ranges outstanding per worker, to hide round trips
+#define TREE_LINE_MAX 1024
+#define TREE_KILL_GRACE 5.0    // seconds from SIGTERM to SIGKILL for a failed worker
+
+typedef struct {
+    uint64_t offset;
+    uint64_t len;
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t digest_len;
+    int done;
+    int attempts;
+} tree_range;
+
+// ---- leaves and root ---------------------------------------------------------
+
+// Transform buffers hold whole chunks so every block starts on a frame boundary
+static size_t leaf_block_size(const dhash_opts* opts) {
+    size_t block = dhash_io_block_size(opts);
+    if (block < opts->chunk_size) return opts->chunk_size;
+    return block - block % opts->chunk_size;
+}
+
+static int pread_full(int fd, uint8_t* buf, size_t len, uint64_t offset) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = pread(fd, buf + got, len - got, (off_t)(offset + got));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            errno = ENODATA;  // the file is shorter than the range
+            return -1;
+        }
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+// Digest of the transformed bytes [offset, offset + len). offset is a multiple
+// of the chunk size, so the only outside context is the byte before it.
+static int tree_leaf(int fd, const tree_range* r, dhash_ctx* ctx, uint8_t* in, uint8_t* out, size_t block,
+                     unsigned char* digest, size_t* digest_len) {
+    const dhash_opts* opts = dhash_ctx_opts(ctx);
+    uint8_t prev = 0;
+    if (r->offset > 0 && pread_full(fd, &prev, 1, r->offset - 1) != 0) return -1;
+    if (dhash_ctx_reset(ctx) != 0) return -1;
+
+    for (uint64_t done = 0; done < r->len;) {
+        size_t n = r->len - done < block ? (size_t)(r->len - done) : block;
+        if (pread_full(fd, in, n, r->offset + done) != 0) return -1;
+        dhash_transform_run(opts, in, n, r->offset + done, prev, out);
+        if (dhash_update_transformed(ctx, out, n) != 0) return -1;
+        prev = in[n - 1];
+        done += n;
+    }
+    return dhash_final(ctx, digest, digest_len);
+}
+
+// The root is the directional hash of a parameter line followed by the leaf
+// digests in file order, so it depends on the range size but not on who
+// computed which range
+static int tree_root(const tree_range* ranges, size_t nranges, uint64_t size, uint64_t range_size,
+                     const dhash_opts* opts, unsigned char* out, size_t* out_len) {
+    dhash_ctx* ctx = dhash_ctx_new(opts);
+    if (!ctx) return -1;
+    char header[256];
+    int len = snprintf(header, sizeof(header), "dhash-tree %d rc%d bits=%d chunk=%zu range=%llu size=%llu\n",
+                       TREE_VERSION, opts->algo, opts->bits, opts->chunk_size, (unsigned long long)range_size,
+                       (unsigned long long)size);
+    int rc = dhash_update(ctx, header, (size_t)len);
+    for (size_t i = 0; rc == 0 && i < nranges; i++) {
+        rc = dhash_update(ctx, ranges[i].digest, ranges[i].digest_len);
+    }
+    if (rc == 0) rc = dhash_final(ctx, out, out_len);
+    dhash_ctx_free(ctx);
+    return rc;
+}
+
+// ---- local tree --------------------------------------------------------------
+
+static int tree_local(int fd, tree_range* ranges, size_t nranges, const dhash_opts* opts) {
+    size_t block = leaf_block_size(opts);
+    dhash_opts leaf_opts = *opts;
+    leaf_opts.max_workers = 1;  // one range per thread
+    int failed = 0;
+
+#pragma omp parallel num_threads(opts->max_workers)
+    {
+        dhash_ctx* ctx = dhash_ctx_new(&leaf_opts);
+        dhash_buffer in = { 0 }, out = { 0 };
+        int ok = ctx && dhash_buffer_alloc(&in, block, opts->huge_pages) == 0
+                 && dhash_buffer_alloc(&out, block, opts->huge_pages) == 0;
+        if (!ok) {
+#pragma omp atomic write
+            failed = 1;
+        }
+
+#pragma omp for schedule(dynamic, 1)
+        for (size_t i = 0; i < nranges; i++) {
+            int stop;
+#pragma omp atomic read
+            stop = failed;
+            if (!ok || stop) continue;
+            if (tree_leaf(fd, &ranges[i], ctx, in.data, out.data, block, ranges[i].digest, &ranges[i].digest_len) != 0) {
+                fprintf(stderr, "Range at %llu: %s\n", (unsigned long long)ranges[i].offset, strerror(errno));
+#pragma omp atomic write
+                failed = 1;
+            }
+        }
+
+        if (in.data) dhash_buffer_free(&in);
+        if (out.data) dhash_buffer_free(&out);
+        dhash_ctx_free(ctx);
+    }
+    return failed ? -1 : 0;
+}
+
+// ---- worker ------------------------------------------------------------------
+
+// Requests on stdin are "<index> <offset> <length>"; replies on stdout are
+// "<index> OK <hex>" or "<index> ERR <reason>". The first line announces the
+// protocol version and the digest parameters so a mismatched remote binary is
+// caught before it returns anything.
+int dhash_tree_worker(const char* filename, const dhash_opts* opts) {
+    int fd = dhash_open_input(filename, opts);
+    if (fd < 0) {
+        perror(filename);
+        return 1;
+    }
+    dhash_init();
+    size_t block = leaf_block_size(opts);
+    dhash_opts leaf_opts = *opts;
+    leaf_opts.max_workers = 1;
+    dhash_ctx* ctx = dhash_ctx_new(&leaf_opts);
+    dhash_buffer in = { 0 }, out = { 0 };
+    if (!ctx || dhash_buffer_alloc(&in, block, opts->huge_pages) != 0
+        || dhash_buffer_alloc(&out, block, opts->huge_pages) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    printf("dhash-tree-worker %d rc%d bits=%d chunk=%zu\n", TREE_VERSION, opts->algo, opts->bits, opts->chunk_size);
+    fflush(stdout);
+
+    char line[TREE_LINE_MAX];
+    while (fgets(line, sizeof(line), stdin)) {
+        unsigned long long index, offset, len;
+        if (sscanf(line, "%llu %llu %llu", &index, &offset, &len) != 3) {
+            printf("- ERR bad request\n");
+            fflush(stdout);
+            continue;
+        }
+        tree_range r = { .offset = offset, .len = len };
+        if (offset % opts->chunk_size != 0) {
+            printf("%llu ERR offset not on a chunk boundary\n", index);
+        } else if (tree_leaf(fd, &r, ctx, in.data, out.data, block, r.digest, &r.digest_len) != 0) {
+            printf("%llu ERR %s\n", index, strerror(errno));
+        } else {
+            char hex[2 * DHASH_MAX_DIGEST + 1];
+            dhash_hex(r.digest, r.digest_len, hex);
+            printf("%llu OK %s\n", index, hex);
+        }
+        fflush(stdout);
+    }
+
+    dhash_buffer_free(&in);
+    dhash_buffer_free(&out);
+    dhash_ctx_free(ctx);
+    close(fd);
+    return 0;
+}
+
+// ---- coordinator -------------------------------------------------------------
+
+typedef struct {
+    const char* command;   // shell command prefix, NULL for a local process
+    pid_t pid;
+    int to, from;          // its stdin and stdout
+    char buf[TREE_LINE_MAX];
+    size_t have;
+    int ready;             // handshake seen
+    size_t busy[TREE_PIPELINE];
+    int nbusy;
+    double since;          // start of the handshake or of the range it is on now
+    int restarts;
+    int alive;
+} tree_worker;
+
+typedef struct {
+    tree_range* ranges;
+    size_t nranges;
+    size_t* queue;         // ring of ranges waiting for a worker
+    size_t qhead, qcount;
+    size_t remaining;
+    int retries;
+    double range_timeout;
+    int failed;            // some range failed more than retries times
+    const char* filename;
+    const dhash_opts* opts;
+    char self[PATH_MAX];
+} tree_job;
+
+static void queue_push(tree_job* job, size_t i) {
+    job->queue[(job->qhead + job->qcount++) % job->nranges] = i;
+}
+
+static size_t queue_pop(tree_job* job) {
+    size_t i = job->queue[job->qhead];
+    job->qhead = (job->qhead + 1) % job->nranges;
+    job->qcount--;
+    return i;
+}
+
+// Single-quote s for /bin/sh
+static void shell_quote(char* dst, size_t size, const char* s) {
+    size_t o = 0;
+    if (o < size) dst[o++] = '\'';
+    for (; *s && o + 5 < size; s++) {
+        if (*s == '\'') {
+            memcpy(dst + o, "'\\''", 4);
+            o += 4;
+        } else {
+            dst[o++] = *s;
+        }
+    }
+    if (o + 1 < size) dst[o++] = '\'';
+    dst[o < size ? o : size - 1] = '\0';
+}
+
+static int worker_spawn(tree_worker* w, tree_job* job) {
+    const dhash_opts* o = job->opts;
+    char algo[8], bits[16], chunk[32], block[32];
+    snprintf(algo, sizeof(algo), "rc%d", o->algo);
+    snprintf(bits, sizeof(bits), "%d", o->bits);
+    snprintf(chunk, sizeof(chunk), "%zu", o->chunk_size);
+    snprintf(block, sizeof(block), "%zu", o->block_size);
+
+    char cmd[2 * PATH_MAX + 256];
+    if (w->command) {
+        char quoted[2 * PATH_MAX];
+        shell_quote(quoted, sizeof(quoted), job->filename);
+        snprintf(cmd, sizeof(cmd), "%s --tree-worker %s --algo %s --bits %s --chunk-size %s --block-size %s%s",
+                 w->command, quoted, algo, bits, chunk, block, o->direct_io ? " --direct" : "");
+    }
+
+    int to[2], from[2];
+    if (pipe2(to, O_CLOEXEC) != 0) return -1;
+    if (pipe2(from, O_CLOEXEC) != 0) {
+        close(to[0]);
+        close(to[1]);
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(to[0]);
+        close(to[1]);
+        close(from[0]);
+        close(from[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(to[0], STDIN_FILENO);
+        dup2(from[1], STDOUT_FILENO);
+        if (w->command) {
+            execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+        } else {
+            execl(job->self, job->self, "--tree-worker", job->filename, "--algo", algo, "--bits", bits,
+                  "--chunk-size", chunk, "--block-size", block, o->direct_io ? "--direct" : (char*)NULL, (char*)NULL);
+        }
+        _exit(127);
+    }
+    close(to[0]);
+    close(from[1]);
+    w->pid = pid;
+    w->to = to[1];
+    w->from = from[0];
+    w->have = 0;
+    w->ready = 0;
+    w->nbusy = 0;
+    w->since = dhash_metrics_now();
+    w->alive = 1;
+    return 0;
+}
+
+// A range failed once more; more than retries times fails the whole tree
+static void range_retry(tree_job* job, size_t i) {
+    tree_range* r = &job->ranges[i];
+    if (++r->attempts > job->retries) {
+        fprintf(stderr, "Range at %llu failed %d times\n", (unsigned long long)r->offset, r->attempts);
+        job->failed = 1;
+    }
+    queue_push(job, i);
+}
+
+// Wait for w to exit, killing it once grace seconds are up (0 waits for good)
+static void worker_reap(tree_worker* w, double grace) {
+    double end = dhash_metrics_now() + grace;
+    while (grace > 0 && dhash_metrics_now() < end) {
+        pid_t got = waitpid(w->pid, NULL, WNOHANG);
+        if (got == w->pid || (got < 0 && errno != EINTR)) return;
+        usleep(10000);
+    }
+    if (grace > 0) kill(w->pid, SIGKILL);
+    waitpid(w->pid, NULL, 0);
+}
+
+// Requeue the worker's ranges and restart it while it has retries left
+static void worker_fail(tree_worker* w, tree_job* job, const char* why) {
+    fprintf(stderr, "tree worker %d (%s): %s\n", (int)w->pid, w->command ? w->command : "local", why);
+    kill(w->pid, SIGTERM);
+    close(w->to);
+    close(w->from);
+    worker_reap(w, TREE_KILL_GRACE);
+    w->alive = 0;
+
+    for (int k = 0; k < w->nbusy; k++) range_retry(job, w->busy[k]);
+    w->nbusy = 0;
+    if (!job->failed && w->restarts < job->retries) {
+        w->restarts++;
+        if (worker_spawn(w, job) != 0) perror("Failed to restart tree worker");
+    }
+}
+
+static int parse_hex(const char* hex, unsigned char* out, size_t* out_len) {
+    size_t n = strlen(hex);
+    if (n % 2 || n / 2 > DHASH_MAX_DIGEST) return -1;
+    for (size_t i = 0; i < n / 2; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1) return -1;
+        out[i] = (unsigned char)v;
+    }
+    *out_len = n / 2;
+    return 0;
+}
+
+// One reply line from w; returns -1 when the worker has to be dropped
+static int worker_line(tree_worker* w, tree_job* job, char* line, const char** why) {
+    if (!w->ready) {
+        char expect[128];
+        snprintf(expect, sizeof(expect), "dhash-tree-worker %d rc%d bits=%d chunk=%zu", TREE_VERSION,
+                 job->opts->algo, job->opts->bits, job->opts->chunk_size);
+        w->ready = strcmp(line, expect) == 0;
+        *why = "unexpected greeting (wrong binary or parameters?)";
+        return w->ready ? 0 : -1;
+    }
+    unsigned long long index;
+    char status[8], rest[2 * DHASH_MAX_DIGEST + TREE_LINE_MAX];
+    *why = "malformed reply";
+    if (sscanf(line, "%llu %7s %[^\n]", &index, status, rest) != 3) return -1;
+    int k = 0;
+    while (k < w->nbusy && w->busy[k] != index) k++;
+    if (k == w->nbusy || index >= job->nranges) return -1;
+    w->busy[k] = w->busy[--w->nbusy];
+    w->since = dhash_metrics_now();  // it moves on to the next range it holds
+
+    tree_range* r = &job->ranges[index];
+    if (strcmp(status, "OK") == 0) {
+        if (parse_hex(rest, r->digest, &r->digest_len) != 0) return -1;
+        r->done = 1;
+        job->remaining--;
+        return 0;
+    }
+    fprintf(stderr, "Range at %llu: %s\n", (unsigned long long)r->offset, rest);
+    range_retry(job, (size_t)index);
+    return 0;
+}
+
+static int tree_distributed(const char* filename, tree_range* ranges, size_t nranges, const dhash_opts* opts,
+                            const dhash_tree_opts* t) {
+    int nworkers = t->local_workers + t->ncommands;
+    tree_job job = { .ranges = ranges, .nranges = nranges, .remaining = nranges, .retries = t->retries,
+                     .range_timeout = t->range_timeout, .filename = filename, .opts = opts };
+    ssize_t n = readlink("/proc/self/exe", job.self, sizeof(job.self) - 1);
+    if (n <= 0) {
+        perror("/proc/self/exe");
+        return -1;
+    }
+    job.self[n] = '\0';
+    job.queue = malloc(nranges * sizeof(*job.queue));
+    tree_worker* workers = calloc((size_t)nworkers, sizeof(*workers));
+    struct pollfd* fds = calloc((size_t)nworkers, sizeof(*fds));
+    if (!job.queue || !workers || !fds) {
+        perror("Failed to allocate tree workers");
+        free(job.queue);
+        free(workers);
+        free(fds);
+        return -1;
+    }
+    for (size_t i = 0; i < nranges; i++) queue_push(&job, i);
+
+    // A worker that dies mid-write must not take the coordinator with it
+    struct sigaction ign = { .sa_handler = SIG_IGN }, old_pipe;
+    sigaction(SIGPIPE, &ign, &old_pipe);
+
+    for (int k = 0; k < nworkers; k++) {
+        workers[k].command = k < t->ncommands ? t->commands[k] : NULL;
+        if (worker_spawn(&workers[k], &job) != 0) perror("Failed to start tree worker");
+    }
+
+    int rc = 0;
+    while (!job.failed && job.remaining > 0) {
+        int nalive = 0;
+        int wait_ms = -1;
+        for (int k = 0; k < nworkers && !job.failed; k++) {
+            tree_worker* w = &workers[k];
+            if (!w->alive) continue;
+            // A hung worker or host gives its ranges back rather than stalling the tree
+            if (job.range_timeout > 0 && (w->nbusy > 0 || !w->ready)
+                && dhash_metrics_now() - w->since >= job.range_timeout) {
+                worker_fail(w, &job, w->ready ? "range timed out" : "no greeting in time");
+                if (!w->alive || job.failed) continue;
+            }
+            // Assign only after the handshake so a wrong binary costs no attempts
+            while (w->alive && w->ready && w->nbusy < TREE_PIPELINE && job.qcount > 0) {
+                size_t i = queue_pop(&job);
+                if (w->nbusy == 0) w->since = dhash_metrics_now();
+                char line[128];
+                int len = snprintf(line, sizeof(line), "%zu %llu %llu\n", i, (unsigned long long)ranges[i].offset,
+                                   (unsigned long long)ranges[i].len);
+                w->busy[w->nbusy++] = i;
+                if (write(w->to, line, (size_t)len) != len) worker_fail(w, &job, "request failed");
+            }
+            if (!w->alive) continue;
+            fds[nalive++] = (struct pollfd){ .fd = w->from, .events = POLLIN };
+            if (job.range_timeout > 0 && (w->nbusy > 0 || !w->ready)) {
+                double left = w->since + job.range_timeout - dhash_metrics_now();
+                int ms = left > 0 ? (int)(left * 1000) + 1 : 0;
+                if (wait_ms < 0 || ms < wait_ms) wait_ms = ms;
+            }
+        }
+        if (job.failed) break;
+        if (nalive == 0) {
+            fprintf(stderr, "No tree workers left with %zu ranges to go\n", job.remaining);
+            rc = -1;
+            break;
+        }
+        if (poll(fds, (nfds_t)nalive, wait_ms) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            rc = -1;
+            break;
+        }
+
+        // Match descriptors by value: a worker restarted above is not in fds
+        for (int f = 0; f < nalive && !job.failed; f++) {
+            if (fds[f].revents == 0) continue;
+            tree_worker* w = NULL;
+            for (int k = 0; k < nworkers && !w; k++) {
+                if (workers[k].alive && workers[k].from == fds[f].fd) w = &workers[k];
+            }
+            if (!w) continue;
+            ssize_t got = read(w->from, w->buf + w->have, sizeof(w->buf) - 1 - w->have);
+            if (got <= 0) {
+                if (got < 0 && errno == EINTR) continue;
+                worker_fail(w, &job, got == 0 ? "exited" : strerror(errno));
+                continue;
+            }
+            w->have += (size_t)got;
+            w->buf[w->have] = '\0';
+            char* start = w->buf;
+            char* nl;
+            const char* why = NULL;
+            int bad = 0;
+            while (!bad && (nl = strchr(start, '\n')) != NULL) {
+                *nl = '\0';
+                bad = worker_line(w, &job, start, &why) != 0;
+                start = nl + 1;
+            }
+            if (!bad && start == w->buf && w->have == sizeof(w->buf) - 1) {
+                bad = 1;
+                why = "reply too long";
+            }
+            if (bad) {
+                worker_fail(w, &job, why);
+                continue;
+            }
+            w->have -= (size_t)(start - w->buf);
+            memmove(w->buf, start, w->have);
+        }
+    }
+
+    if (job.failed) rc = -1;
+    for (int k = 0; k < nworkers; k++) {
+        if (!workers[k].alive) continue;
+        close(workers[k].to);  // EOF ends the worker
+        close(workers[k].from);
+        if (rc != 0) kill(workers[k].pid, SIGTERM);
+        worker_reap(&workers[k], job.range_timeout);
+    }
+    sigaction(SIGPIPE, &old_pipe, NULL);
+    free(job.queue);
+    free(workers);
+    free(fds);
+    return rc;
+}
+
+// ---- entry point -------------------------------------------------------------
+
+int dhash_tree_file(const char* filename, const dhash_opts* opts, const dhash_tree_opts* t) {
+    uint64_t range_size = t->range_size;
+    if (range_size == 0) {
+        range_size = DHASH_TREE_RANGE + (opts->chunk_size - DHASH_TREE_RANGE % opts->chunk_size) % opts->chunk_size;
+    } else if (range_size % opts->chunk_size != 0) {
+        fprintf(stderr, "Range size %llu is not a multiple of the chunk size %zu\n",
+                (unsigned long long)range_size, opts->chunk_size);
+        return 1;
+    }
+
+    int fd = dhash_open_input(filename, opts);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(filename);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    size_t nranges = (size_t)((size + range_size - 1) / range_size);
+    tree_range* ranges = calloc(nranges ? nranges : 1, sizeof(*ranges));
+    if (!ranges) {
+        perror("Failed to allocate ranges");
+        close(fd);
+        return 1;
+    }
+    for (size_t i = 0; i < nranges; i++) {
+        ranges[i].offset = i * range_size;
+        ranges[i].len = size - ranges[i].offset < range_size ? size - ranges[i].offset : range_size;
+    }
+
+    dhash_init();
+    int rc;
+    if (nranges == 0) {
+        rc = 0;
+    } else if (t->local_workers + t->ncommands > 0) {
+        rc = tree_distributed(filename, ranges, nranges, opts, t);
+    } else {
+        rc = tree_local(fd, ranges, nranges, opts);
+    }
+    close(fd);
+
+    unsigned char digest[DHASH_MAX_DIGEST];
+    char hex[DHASH_FORMAT_MAX];
+    size_t len = 0;
+    if (rc == 0 && t->print_leaves) {
+        for (size_t i = 0; i < nranges; i++) {
+            dhash_format(opts, ranges[i].digest, ranges[i].digest_len, hex);
+            printf("%llu %llu %s\n", (unsigned long long)ranges[i].offset, (unsigned long long)ranges[i].len, hex);
+        }
+    }
+    if (rc == 0) rc = tree_root(ranges, nranges, size, range_size, opts, digest, &len);
+    if (rc == 0) {
+        dhash_format(opts, digest, len, hex);
+        printf("%s\n", hex);
+    }
+    free(ranges);
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+#include "dhash_numa.h"
+#include "dhash_tune.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TUNE_REPEATS 3
+
+// Representative input per class, and the largest input the class covers
+static const uint64_t sample_size[DHASH_TUNE_CLASSES] = { 256 << 10, 8 << 20, 128 << 20 };
+static const uint64_t class_max[DHASH_TUNE_CLASSES] = { 1 << 20, 64 << 20, UINT64_MAX };
+static const char* class_name[DHASH_TUNE_CLASSES] = { "small", "medium", "large" };
+static const size_t block_candidates[] = { 64 << 10, 256 << 10, 1 << 20, 4 << 20, 16 << 20 };
+static const char* variant_names[DHASH_VARIANT_COUNT] = { "stream", "numa", "fused" };
+
+const char* dhash_variant_name(dhash_variant variant) {
+    return (variant >= 0 && variant < DHASH_VARIANT_COUNT) ? variant_names[variant] : "?";
+}
+
+static void host_name(char* buf, size_t len) {
+    if (gethostname(buf, len) != 0) snprintf(buf, len, "localhost");
+    buf[len - 1] = '\0';
+}
+
+int dhash_profile_path(char* buf, size_t len) {
+    const char* xdg = getenv("XDG_CONFIG_HOME");
+    const char* home = getenv("HOME");
+    int n;
+    if (xdg && *xdg) n = snprintf(buf, len, "%s/dhash/profile", xdg);
+    else if (home && *home) n = snprintf(buf, len, "%s/.config/dhash/profile", home);
+    else return -1;
+    return (n > 0 && (size_t)n < len) ? 0 : -1;
+}
+
+// One line per class: "<host> <class> max=N block=N workers=N variant=NAME mbps=F"
+int dhash_profile_load(const char* path, dhash_profile* profile) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    host_name(profile->host, sizeof(profile->host));
+
+    char line[512], host[256], cls[32], variant[32];
+    int found = 0;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long max, block;
+        int workers;
+        double mbps;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%255s %31s max=%llu block=%llu workers=%d variant=%31s mbps=%lf",
+                   host, cls, &max, &block, &workers, variant, &mbps) != 7) continue;
+        if (strcmp(host, profile->host) != 0) continue;
+        for (int c = 0; c < DHASH_TUNE_CLASSES; c++) {
+            if (strcmp(cls, class_name[c]) != 0) continue;
+            dhash_tune_class* t = &profile->cls[c];
+            t->max_size = max;
+            t->block_size = block;
+            t->workers = workers;
+            t->variant = DHASH_VARIANT_STREAM;
+            for (int v = 0; v < DHASH_VARIANT_COUNT; v++) {
+                if (strcmp(variant, variant_names[v]) == 0) t->variant = v;
+            }
+            t->mb_per_s = mbps;
+            found |= 1 << c;
+        }
+    }
+    fclose(f);
+    return found == (1 << DHASH_TUNE_CLASSES) - 1 ? 0 : -1;
+}
+
+static int make_parent_dirs(const char* path) {
+    char dir[4096];
+    if (strlen(path) >= sizeof(dir)) return -1;
+    strcpy(dir, path);
+    for (char* p = dir + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return 0;
+}
+
+int dhash_profile_save(const char* path, const dhash_profile* profile) {
+    char tmp[4200];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (make_parent_dirs(path) != 0) {
+        perror(path);
+        return -1;
+    }
+    FILE* out = fopen(tmp, "w");
+    if (!out) {
+        perror(tmp);
+        return -1;
+    }
+
+    // Keep the other hosts' entries so one profile can serve a shared home
+    FILE* in = fopen(path, "r");
+    if (in) {
+        char line[512], host[256];
+        while (fgets(line, sizeof(line), in)) {
+            if (line[0] == '#') continue;
+            if (sscanf(line, "%255s", host) == 1 && strcmp(host, profile->host) == 0) continue;
+            fputs(line, out);
+        }
+        fclose(in);
+    } else {
+        fprintf(out, "# dhash --autotune profile: <host> <class> max block workers variant mbps\n");
+    }
+    for (int c = 0; c < DHASH_TUNE_CLASSES; c++) {
+        const dhash_tune_class* t = &profile->cls[c];
+        fprintf(out, "%s %s max=%llu block=%zu workers=%d variant=%s mbps=%.1f\n",
+                profile->host, class_name[c], (unsigned long long)t->max_size,
+                t->block_size, t->workers, dhash_variant_name(t->variant), t->mb_per_s);
+    }
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        perror(path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+const dhash_tune_class* dhash_profile_lookup(const dhash_profile* profile, uint64_t size) {
+    for (int c = 0; c < DHASH_TUNE_CLASSES - 1; c++) {
+        if (size <= profile->cls[c].max_size) return &profile->cls[c];
+    }
+    return &profile->cls[DHASH_TUNE_CLASSES - 1];
+}
+
+int dhash_file_variant(const char* filename, const dhash_opts* opts, dhash_variant variant,
+                       unsigned char* out, size_t* out_len) {
+    dhash_opts o = *opts;
+    o.numa = (variant == DHASH_VARIANT_NUMA);
+    if (o.numa) return dhash_numa_file(filename, &o, out, out_len);
+    o.fused = (variant == DHASH_VARIANT_FUSED);
+    return dhash_file(filename, &o, out, out_len);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Incompressible, reproducible sample data
+static int write_sample(int fd, uint64_t size) {
+    static uint64_t buf[(1 << 20) / 8];
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    while (size > 0) {
+        for (size_t i = 0; i < sizeof(buf) / 8; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            buf[i] = x;
+        }
+        size_t n = size < sizeof(buf) ? (size_t)size : sizeof(buf);
+        if (write(fd, buf, n) != (ssize_t)n) return -1;
+        size -= n;
+    }
+    return 0;
+}
+
+// Best of TUNE_REPEATS full hashes of the sample, in MB/s; 0 on failure
+static double measure(const char* path, uint64_t size, const dhash_opts* opts, dhash_variant variant) {
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t len;
+    double best = 0;
+    for (int r = 0; r < TUNE_REPEATS; r++) {
+        double t0 = now_seconds();
+        if (dhash_file_variant(path, opts, variant, digest, &len) != 0) return 0;
+        double dt = now_seconds() - t0;
+        double rate = dt > 0 ? size / dt / 1e6 : 0;
+        if (rate > best) best = rate;
+    }
+    return best;
+}
+
+// Coordinate search per variant: block size at full width, then worker count
+static dhash_tune_class tune_class(const char* path, uint64_t size, const dhash_opts* base, int ncpu) {
+    dhash_tune_class best = { 0 };
+    for (int v = 0; v < DHASH_VARIANT_COUNT; v++) {
+        dhash_opts o = *base;
+        o.max_workers = ncpu;
+        size_t best_block = DHASH_DEFAULT_BLOCK;
+        double best_rate = 0;
+        for (size_t b = 0; b < sizeof(block_candidates) / sizeof(block_candidates[0]); b++) {
+            // Blocks beyond the sample all behave like the first that covers it
+            if (b > 0 && block_candidates[b - 1] >= size) break;
+            o.block_size = block_candidates[b];
+            double rate = measure(path, size, &o, v);
+            if (rate > best_rate) {
+                best_rate = rate;
+                best_block = o.block_size;
+            }
+        }
+        o.block_size = best_block;
+
+        // The fused loop transforms on the calling thread
+        int best_workers = (v == DHASH_VARIANT_FUSED) ? 1 : ncpu;
+        for (int w = 1; v != DHASH_VARIANT_FUSED && w <= 2 * ncpu && w <= 256; w = (w < ncpu && 2 * w > ncpu) ? ncpu : 2 * w) {
+            if (w == ncpu) continue;  // measured above
+            o.max_workers = w;
+            double rate = measure(path, size, &o, v);
+            if (rate > best_rate) {
+                best_rate = rate;
+                best_workers = w;
+            }
+        }
+
+        if (best_rate > best.mb_per_s) {
+            best.block_size = best_block;
+            best.workers = best_workers;
+            best.variant = v;
+            best.mb_per_s = best_rate;
+        }
+    }
+    return best;
+}
+
+int dhash_autotune_run(const dhash_opts* opts, const char* path) {
+    const char* tmpdir = getenv("TMPDIR");
+    char sample[4096];
+    snprintf(sample, sizeof(sample), "%s/dhash-tune-XXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp");
+    int fd = mkstemp(sample);
+    if (fd < 0) {
+        perror("Failed to create calibration file");
+        return 1;
+    }
+
+    int ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu = 1;
+    dhash_profile profile;
+    memset(&profile, 0, sizeof(profile));
+    host_name(profile.host, sizeof(profile.host));
+    // The profile only holds I/O and scheduling settings, so tune without limits
+    dhash_opts base = *opts;
+    base.throttle = NULL;
+
+    printf("Calibrating %s (%d CPUs, %d-bit digest, chunk %zu%s)\n", profile.host, ncpu,
+           opts->bits, opts->chunk_size, opts->direct_io ? ", O_DIRECT" : ", page cache");
+    printf("%-7s %10s %10s %8s %8s %10s\n", "class", "up to", "block", "workers", "variant", "MB/s");
+
+    int rc = 0;
+    uint64_t written = 0;
+    for (int c = 0; c < DHASH_TUNE_CLASSES; c++) {
+        // Grow the one sample file to each class size in turn
+        if (write_sample(fd, sample_size[c] - written) != 0) {
+            perror("Failed to write calibration file");
+            rc = 1;
+            break;
+        }
+        written = sample_size[c];
+
+        dhash_tune_class t = tune_class(sample, written, &base, ncpu);
+        if (t.mb_per_s <= 0) {
+            rc = 1;
+            break;
+        }
+        t.max_size = class_max[c];
+        profile.cls[c] = t;
+
+        char limit[32];
+        if (t.max_size == UINT64_MAX) snprintf(limit, sizeof(limit), "-");
+        else snprintf(limit, sizeof(limit), "%lluK", (unsigned long long)(t.max_size >> 10));
+        printf("%-7s %10s %9zuK %8d %8s %10.1f\n", class_name[c], limit, t.block_size >> 10,
+               t.workers, dhash_variant_name(t.variant), t.mb_per_s);
+        fflush(stdout);
+    }
+
+    close(fd);
+    unlink(sample);
+    if (rc == 0) {
+        if (dhash_profile_save(path, &profile) != 0) return 1;
+        printf("Saved profile to %s\n", path);
+    }
+    return rc;
+}
@@ -0,0 +1,49 @@
+#ifndef DHASH_TUNE_H
+#define DHASH_TUNE_H
+
+#include "dhash.h"
+
+// Per-host tuning profile written by --autotune and loaded by later runs.
+// Only settings that leave the digest unchanged are tuned: chunk_size is part
+// of the rc5 digest definition and always comes from the command line.
+
+#define DHASH_TUNE_CLASSES 3  // small, medium, large inputs
+
+typedef enum {
+    DHASH_VARIANT_STREAM = 0,  // dhash_file: read loop, OpenMP split per block
+    DHASH_VARIANT_NUMA,        // dhash_numa_file: pinned workers, overlapped digest
+    DHASH_VARIANT_FUSED,       // dhash_file with opts.fused: L1 tiles, one thread
+    DHASH_VARIANT_COUNT
+} dhash_variant;
+
+typedef struct {
+    uint64_t max_size;  // inputs up to this size use the class (UINT64_MAX for the last)
+    size_t block_size;
+    int workers;
+    dhash_variant variant;
+    double mb_per_s;    // calibration result, informational
+} dhash_tune_class;
+
+typedef struct {
+    char host[256];
+    dhash_tune_class cls[DHASH_TUNE_CLASSES];
+} dhash_profile;
+
+// $XDG_CONFIG_HOME/dhash/profile, else ~/.config/dhash/profile
+int dhash_profile_path(char* buf, size_t len);
+// Load this host's entry; returns -1 when the file or the host entry is missing
+int dhash_profile_load(const char* path, dhash_profile* profile);
+// Replace this host's entry, keeping other hosts' lines (shared home directories)
+int dhash_profile_save(const char* path, const dhash_profile* profile);
+const dhash_tune_class* dhash_profile_lookup(const dhash_profile* profile, uint64_t size);
+const char* dhash_variant_name(dhash_variant variant);
+
+// Hash with the variant chosen for this input
+int dhash_file_variant(const char* filename, const dhash_opts* opts, dhash_variant variant,
+                       unsigned char* out, size_t* out_len);
+
+// Calibrate every size class with opts' bits/chunk_size (and direct_io), print
+// the table and save it to path. Returns the process exit code.
+int dhash_autotune_run(const dhash_opts* opts, const char* path);
+
+#endif
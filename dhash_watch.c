@@ -0,0 +1,576 @@
+#define _GNU_SOURCE
+#include "dhash_modes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define WATCH_DIR_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE \
+                        | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+#define WATCH_MAX_DELAY 10     // a file written continuously is still hashed every 10 debounce periods
+#define WATCH_EVENT_BUF 65536
+
+typedef struct watch_entry {
+    char* path;
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t digest_len;
+    int known;        // digest is valid and the file existed when last hashed
+    int silent;       // found by the initial scan: record the digest, report nothing
+    int dirty;        // on the dirty list, due for hashing
+    int in_flight;    // handed to the pool
+    double first;     // first event of the current burst
+    double due;
+} watch_entry;
+
+typedef struct watch_job {
+    struct watch_job* next;
+    watch_entry* e;
+    unsigned char digest[DHASH_MAX_DIGEST];
+    size_t digest_len;
+    int err;          // 0, ENOENT when the file is gone, else the errno of the failure
+} watch_job;
+
+static struct {
+    // Owned by the event loop
+    watch_entry** slots;   // open addressing by path
+    size_t nslots, nentries;
+    watch_entry** dirty;
+    size_t ndirty, dirty_cap;
+    char** dirs;           // watch descriptor -> directory path
+    int ndirs;
+    size_t baseline;       // initial-scan hashes not yet finished
+    double debounce;
+
+    // Shared with the workers
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    watch_job* todo;
+    watch_job* todo_tail;
+    watch_job* done;
+    int stop;
+    int wake[2];           // workers -> event loop
+
+    dhash_opts opts;
+    dhash_metrics* metrics;
+} watch = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .wake = { -1, -1 },
+};
+
+static volatile sig_atomic_t watch_stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    watch_stop = 1;
+}
+
+// ---- path table --------------------------------------------------------------
+
+static size_t path_hash(const char* s) {
+    size_t h = 14695981039346656037ull;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    return h;
+}
+
+// Nothing refers to an entry that is not known, dirty or in flight: the
+// dirty list and the jobs hold only the others
+static int entry_dead(const watch_entry* e) {
+    return !e->known && !e->dirty && !e->in_flight;
+}
+
+// Rehash with room to spare, dropping dead entries
+// (deleted files, failed hashes) so a tree with churn does not grow it forever
+static int table_rebuild(void) {
+    size_t live = 0;
+    for (size_t i = 0; i < watch.nslots; i++) {
+        if (watch.slots[i] && !entry_dead(watch.slots[i])) live++;
+    }
+    // Half full at most afterwards, so rebuilds stay amortised however few died
+    size_t nslots = watch.nslots ? watch.nslots : 1024;
+    while (4 * (live + 1) > nslots) nslots *= 2;
+    watch_entry** slots = calloc(nslots, sizeof(*slots));
+    if (!slots) return -1;
+    for (size_t i = 0; i < watch.nslots; i++) {
+        watch_entry* e = watch.slots[i];
+        if (!e) continue;
+        if (entry_dead(e)) {
+            free(e->path);
+            free(e);
+            continue;
+        }
+        size_t j = path_hash(e->path) & (nslots - 1);
+        while (slots[j]) j = (j + 1) & (nslots - 1);
+        slots[j] = e;
+    }
+    free(watch.slots);
+    watch.slots = slots;
+    watch.nslots = nslots;
+    watch.nentries = live;
+    return 0;
+}
+
+// A deleted file keeps its entry (known = 0) while a job for it may be in
+// flight, and a re-created file reuses it; dead entries go when the table is
+// next rebuilt. Callers must not keep entries across calls.
+static watch_entry* entry_get(const char* path) {
+    if (2 * (watch.nentries + 1) > watch.nslots && table_rebuild() != 0) return NULL;
+    size_t j = path_hash(path) & (watch.nslots - 1);
+    while (watch.slots[j]) {
+        if (strcmp(watch.slots[j]->path, path) == 0) return watch.slots[j];
+        j = (j + 1) & (watch.nslots - 1);
+    }
+    watch_entry* e = calloc(1, sizeof(*e));
+    if (!e || !(e->path = strdup(path))) {
+        free(e);
+        return NULL;
+    }
+    watch.slots[j] = e;
+    watch.nentries++;
+    return e;
+}
+
+// Note an event on e; it is hashed once it has been quiet for the debounce period
+static void entry_touch(watch_entry* e, double now) {
+    if (!e->dirty) {
+        if (watch.ndirty == watch.dirty_cap) {
+            size_t cap = watch.dirty_cap ? watch.dirty_cap * 2 : 256;
+            watch_entry** d = realloc(watch.dirty, cap * sizeof(*d));
+            if (!d) {
+                perror("Failed to queue change");
+                return;
+            }
+            watch.dirty = d;
+            watch.dirty_cap = cap;
+        }
+        watch.dirty[watch.ndirty++] = e;
+        e->dirty = 1;
+        e->first = now;
+    }
+    e->due = now + watch.debounce;
+    double latest = e->first + WATCH_MAX_DELAY * watch.debounce;
+    if (e->due > latest) e->due = latest;
+}
+
+static void touch_path(const char* path, double now) {
+    watch_entry* e = entry_get(path);
+    if (e) entry_touch(e, now);
+}
+
+// Every known file under dir (a deleted or moved-away directory)
+static void touch_prefix(const char* dir, double now) {
+    size_t len = strlen(dir);
+    for (size_t i = 0; i < watch.nslots; i++) {
+        watch_entry* e = watch.slots[i];
+        if (e && e->known && strncmp(e->path, dir, len) == 0 && e->path[len] == '/') entry_touch(e, now);
+    }
+}
+
+// ---- directories -------------------------------------------------------------
+
+static char* join_path(const char* dir, const char* name) {
+    size_t a = strlen(dir), b = strlen(name);
+    char* p = malloc(a + b + 2);
+    if (!p) return NULL;
+    memcpy(p, dir, a);
+    p[a] = '/';
+    memcpy(p + a + 1, name, b + 1);
+    return p;
+}
+
+static int dir_set(int wd, const char* path) {
+    if (wd >= watch.ndirs) {
+        int n = watch.ndirs ? watch.ndirs : 64;
+        while (n <= wd) n *= 2;
+        char** dirs = realloc(watch.dirs, (size_t)n * sizeof(*dirs));
+        if (!dirs) return -1;
+        memset(dirs + watch.ndirs, 0, (size_t)(n - watch.ndirs) * sizeof(*dirs));
+        watch.dirs = dirs;
+        watch.ndirs = n;
+    }
+    char* copy = strdup(path);
+    if (!copy) return -1;
+    free(watch.dirs[wd]);
+    watch.dirs[wd] = copy;
+    return 0;
+}
+
+// Watch dir and everything below it, then list it. The watch goes in first so
+// a file created during the scan is seen by one or the other.
+static int add_tree(int ifd, const char* dir, int silent, double now) {
+    int wd = inotify_add_watch(ifd, dir, WATCH_DIR_MASK);
+    if (wd < 0) {
+        int err = errno;
+        if (err == ENOENT || err == ENOTDIR) return 0;  // gone again
+        fprintf(stderr, "%s: %s\n", dir, strerror(err));
+        if (err == ENOSPC) fprintf(stderr, "Raise fs.inotify.max_user_watches to watch this tree\n");
+        return err == ENOSPC ? -1 : 0;
+    }
+    if (dir_set(wd, dir) != 0) {
+        perror("Failed to record watch");
+        return -1;
+    }
+
+    DIR* d = opendir(dir);
+    if (!d) return 0;
+    int rc = 0;
+    struct dirent* de;
+    while (rc == 0 && (de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        char* path = join_path(dir, de->d_name);
+        if (!path) {
+            rc = -1;
+            break;
+        }
+        struct stat st;
+        if (lstat(path, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                rc = add_tree(ifd, path, silent, now);
+            } else if (S_ISREG(st.st_mode)) {
+                watch_entry* e = entry_get(path);
+                if (e && !e->known && !e->dirty && !e->in_flight) {
+                    e->silent = silent;
+                    if (silent) watch.baseline++;
+                    entry_touch(e, now);
+                } else if (e && !silent) {
+                    entry_touch(e, now);
+                }
+            }
+        }
+        free(path);
+    }
+    closedir(d);
+    return rc;
+}
+
+// Stop watching dir and its subdirectories (moved out of the tree)
+static void drop_tree(int ifd, const char* dir) {
+    size_t len = strlen(dir);
+    for (int wd = 0; wd < watch.ndirs; wd++) {
+        char* p = watch.dirs[wd];
+        if (p && strncmp(p, dir, len) == 0 && (p[len] == '\0' || p[len] == '/')) {
+            inotify_rm_watch(ifd, wd);
+            free(p);
+            watch.dirs[wd] = NULL;
+        }
+    }
+}
+
+// ---- worker pool ------------------------------------------------------------
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    dhash_ctx* ctx = dhash_ctx_new(&watch.opts);
+    dhash_buffer io_buffer;
+    if (!ctx || dhash_buffer_alloc(&io_buffer, dhash_io_block_size(&watch.opts), watch.opts.huge_pages) != 0) {
+        exit(1);
+    }
+
+    int reused = 0;  // the context has hashed a file before
+
+    pthread_mutex_lock(&watch.lock);
+    for (;;) {
+        while (!watch.todo && !watch.stop) pthread_cond_wait(&watch.work, &watch.lock);
+        if (watch.stop) break;
+        watch_job* j = watch.todo;
+        watch.todo = j->next;
+        if (!watch.todo) watch.todo_tail = NULL;
+        pthread_mutex_unlock(&watch.lock);
+
+        double t0 = dhash_metrics_now();
+        dhash_io_stats io = { 0 };
+        struct stat st;
+        j->err = 0;
+        // Only regular files are tracked; anything else in its place counts as gone
+        int fd = -1;
+        if (lstat(j->e->path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            j->err = ENOENT;
+        } else if ((fd = dhash_open_input(j->e->path, &watch.opts)) < 0) {
+            j->err = errno;
+        } else {
+            if (reused++) dhash_metrics_cache_hit(watch.metrics);
+            if (dhash_ctx_reset(ctx) != 0 || dhash_update_fd(ctx, fd, io_buffer.data, io_buffer.size, &io) != 0
+                || dhash_final(ctx, j->digest, &j->digest_len) != 0) {
+                j->err = EIO;
+            }
+            close(fd);
+        }
+        if (j->err != ENOENT) {
+            dhash_metrics_record(watch.metrics, io.bytes, dhash_metrics_now() - t0, io.read_seconds, !j->err);
+        }
+
+        pthread_mutex_lock(&watch.lock);
+        j->next = watch.done;
+        watch.done = j;
+        char c = 0;
+        ssize_t w = write(watch.wake[1], &c, 1);  // pipe full means a wakeup is already pending
+        (void)w;
+    }
+    pthread_mutex_unlock(&watch.lock);
+
+    dhash_buffer_free(&io_buffer);
+    dhash_ctx_free(ctx);
+    return NULL;
+}
+
+// Hand every dirty entry whose quiet period has passed to the pool; returns
+// the poll timeout in milliseconds until the next one is due
+static int dispatch_due(double now) {
+    double next = -1;
+    size_t kept = 0;
+    watch_job* head = NULL;
+    watch_job* last = NULL;
+    for (size_t i = 0; i < watch.ndirty; i++) {
+        watch_entry* e = watch.dirty[i];
+        // A file changed again while being hashed waits for that result first
+        if (e->due > now || e->in_flight) {
+            watch.dirty[kept++] = e;
+            if (!e->in_flight && (next < 0 || e->due < next)) next = e->due;
+            continue;
+        }
+        watch_job* j = calloc(1, sizeof(*j));
+        if (!j) {
+            watch.dirty[kept++] = e;
+            continue;
+        }
+        j->e = e;
+        e->dirty = 0;
+        e->in_flight = 1;
+        if (last) last->next = j;
+        else head = j;
+        last = j;
+    }
+    watch.ndirty = kept;
+
+    if (head) {
+        pthread_mutex_lock(&watch.lock);
+        if (watch.todo_tail) watch.todo_tail->next = head;
+        else watch.todo = head;
+        watch.todo_tail = last;
+        pthread_cond_broadcast(&watch.work);
+        pthread_mutex_unlock(&watch.lock);
+    }
+    if (next < 0) return -1;
+    return (int)((next - now) * 1000) + 1;
+}
+
+static void report(const char* event, const watch_entry* e) {
+    char hex[DHASH_FORMAT_MAX] = "-";
+    if (e->known) dhash_format(&watch.opts, e->digest, e->digest_len, hex);
+    printf("%s %s  %s\n", event, hex, e->path);
+    fflush(stdout);
+}
+
+static void collect_results(void) {
+    char drain[256];
+    while (read(watch.wake[0], drain, sizeof(drain)) > 0) {}
+
+    pthread_mutex_lock(&watch.lock);
+    watch_job* j = watch.done;
+    watch.done = NULL;
+    pthread_mutex_unlock(&watch.lock);
+
+    while (j) {
+        watch_job* next = j->next;
+        watch_entry* e = j->e;
+        e->in_flight = 0;
+        if (e->silent) {
+            e->silent = 0;
+            if (--watch.baseline == 0) {
+                fprintf(stderr, "dhash: watching %zu files\n", watch.nentries);
+            }
+            if (j->err == 0) {
+                memcpy(e->digest, j->digest, j->digest_len);
+                e->digest_len = j->digest_len;
+                e->known = 1;
+            }
+        } else if (j->err == ENOENT) {
+            if (e->known) {
+                report("removed", e);
+                e->known = 0;
+            }
+        } else if (j->err) {
+            fprintf(stderr, "%s: %s\n", e->path, strerror(j->err));
+        } else if (!e->known) {
+            memcpy(e->digest, j->digest, j->digest_len);
+            e->digest_len = j->digest_len;
+            e->known = 1;
+            report("added", e);
+        } else if (e->digest_len != j->digest_len || memcmp(e->digest, j->digest, j->digest_len) != 0) {
+            memcpy(e->digest, j->digest, j->digest_len);
+            e->digest_len = j->digest_len;
+            report("modified", e);
+        }
+        free(j);
+        j = next;
+    }
+}
+
+// ---- events -----------------------------------------------------------------
+
+static int handle_events(int ifd, const char* root, double now) {
+    char buf[WATCH_EVENT_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(ifd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) return 0;
+            perror("inotify");
+            return -1;
+        }
+        for (char* p = buf; p < buf + n;) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            p += sizeof(*ev) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // Events were lost: re-check everything we know and rescan
+                fprintf(stderr, "dhash: inotify queue overflowed, rescanning %s\n", root);
+                for (size_t i = 0; i < watch.nslots; i++) {
+                    if (watch.slots[i] && watch.slots[i]->known) entry_touch(watch.slots[i], now);
+                }
+                if (add_tree(ifd, root, 0, now) != 0) return -1;
+                continue;
+            }
+            if (ev->wd < 0 || ev->wd >= watch.ndirs || !watch.dirs[ev->wd]) continue;
+            if (ev->mask & IN_IGNORED) {
+                int is_root = strcmp(watch.dirs[ev->wd], root) == 0;
+                free(watch.dirs[ev->wd]);
+                watch.dirs[ev->wd] = NULL;
+                if (is_root) {
+                    fprintf(stderr, "dhash: %s is no longer watchable\n", root);
+                    return -1;
+                }
+                continue;
+            }
+            if (ev->len == 0) continue;  // IN_DELETE_SELF; the parent reports the name
+
+            char* path = join_path(watch.dirs[ev->wd], ev->name);
+            if (!path) return -1;
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    if (add_tree(ifd, path, 0, now) != 0) {
+                        free(path);
+                        return -1;
+                    }
+                } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    drop_tree(ifd, path);
+                    touch_prefix(path, now);
+                }
+            } else {
+                touch_path(path, now);
+            }
+            free(path);
+        }
+    }
+}
+
+int dhash_watch_run(const char* dir, const dhash_opts* opts, double debounce, dhash_metrics* metrics) {
+    struct stat st;
+    if (stat(dir, &st) != 0) {
+        perror(dir);
+        return 1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "%s: not a directory\n", dir);
+        return 1;
+    }
+    // Reported paths are dir joined with the relative name, without doubled slashes
+    char root[PATH_MAX];
+    size_t len = strlen(dir);
+    while (len > 1 && dir[len - 1] == '/') len--;
+    if (len >= sizeof(root)) {
+        fprintf(stderr, "%s: path too long\n", dir);
+        return 1;
+    }
+    memcpy(root, dir, len);
+    root[len] = '\0';
+
+    dhash_init();
+    watch.opts = *opts;
+    watch.metrics = metrics;
+    watch.debounce = debounce;
+
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd < 0) {
+        perror("inotify_init1");
+        return 1;
+    }
+    if (pipe2(watch.wake, O_NONBLOCK | O_CLOEXEC) != 0) {
+        perror("pipe");
+        close(ifd);
+        return 1;
+    }
+
+    struct sigaction sa = { 0 };
+    sa.sa_handler = on_signal;  // no SA_RESTART, so poll() returns
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int nworkers = opts->max_workers > 0 ? opts->max_workers : 1;
+    pthread_t* workers = calloc((size_t)nworkers, sizeof(*workers));
+    int started = 0;
+    int rc = workers ? 0 : 1;
+    for (; rc == 0 && started < nworkers; started++) {
+        if (pthread_create(&workers[started], NULL, worker_main, NULL) != 0) {
+            perror("Failed to start worker");
+            rc = 1;
+            break;
+        }
+    }
+
+    double now = dhash_metrics_now();
+    if (rc == 0 && add_tree(ifd, root, 1, now) != 0) rc = 1;
+    if (rc == 0 && watch.baseline == 0) fprintf(stderr, "dhash: watching 0 files\n");
+
+    while (rc == 0 && !watch_stop) {
+        struct pollfd fds[2] = { { ifd, POLLIN, 0 }, { watch.wake[0], POLLIN, 0 } };
+        int timeout = dispatch_due(dhash_metrics_now());
+        if (poll(fds, 2, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            rc = 1;
+            break;
+        }
+        now = dhash_metrics_now();
+        if (fds[0].revents && handle_events(ifd, root, now) != 0) rc = 1;
+        if (fds[1].revents) collect_results();
+    }
+
+    pthread_mutex_lock(&watch.lock);
+    watch.stop = 1;
+    pthread_cond_broadcast(&watch.work);
+    pthread_mutex_unlock(&watch.lock);
+    for (int w = 0; w < started; w++) pthread_join(workers[w], NULL);
+    free(workers);
+
+    while (watch.todo) {
+        watch_job* j = watch.todo;
+        watch.todo = j->next;
+        free(j);
+    }
+    while (watch.done) {
+        watch_job* j = watch.done;
+        watch.done = j->next;
+        free(j);
+    }
+    for (size_t i = 0; i < watch.nslots; i++) {
+        if (watch.slots[i]) free(watch.slots[i]->path);
+        free(watch.slots[i]);
+    }
+    for (int wd = 0; wd < watch.ndirs; wd++) free(watch.dirs[wd]);
+    free(watch.slots);
+    free(watch.dirty);
+    free(watch.dirs);
+    close(watch.wake[0]);
+    close(watch.wake[1]);
+    close(ifd);
+    return rc;
+}